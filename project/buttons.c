@@ -0,0 +1,133 @@
+// buttons.c
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/time.h"
+#include "config.h"
+#include "buttons.h"
+#include "events.h"
+
+// the gpio irq and the timer alarms both run on core 0 at the default priority, so
+// they never preempt each other and the state below needs no locking
+typedef struct {
+    uint32_t gpio;
+    bool pressed;                   // debounced level
+    volatile uint32_t last_edge_us; // last raw edge, debounce waits for quiet after it
+    uint64_t burst_us;              // first edge of the current bounce burst
+    uint64_t press_us;              // timestamp of the debounced press
+    alarm_id_t debounce_alarm;
+    alarm_id_t long_alarm;
+} button_t;
+
+static button_t buttons[] = {
+    { .gpio = LEFT_BUTTON },
+    { .gpio = CENTER_BUTTON },
+    { .gpio = RIGHT_BUTTON },
+};
+
+#define BUTTON_COUNT (sizeof(buttons) / sizeof(buttons[0]))
+
+static button_t *find_button(uint32_t gpio) {
+    for (uint i = 0; i < BUTTON_COUNT; i++) {
+        if (buttons[i].gpio == gpio) {
+            return &buttons[i];
+        }
+    }
+    return NULL;
+}
+
+static void post_button_event(event_type_t type, button_t *b, uint64_t timestamp_us) {
+    events_post_at(type, timestamp_us, b->gpio);
+}
+
+/**
+ still held LONG_PRESS_DURATION after the press
+ */
+static int64_t long_press_callback(alarm_id_t id, void *user_data) {
+    button_t *b = user_data;
+
+    b->long_alarm = 0;
+    if (b->pressed) {
+        post_button_event(EV_BUTTON_LONG_PRESS, b, time_us_64());
+    }
+    return 0;
+}
+
+/**
+ runs BUTTON_DEBOUNCE_MS after an edge. if the pin bounced since, wait again,
+ otherwise take the level as the new state
+ */
+static int64_t debounce_callback(alarm_id_t id, void *user_data) {
+    button_t *b = user_data;
+    uint32_t quiet_us = time_us_32() - b->last_edge_us;
+
+    if (quiet_us < BUTTON_DEBOUNCE_MS * 1000) {
+        return BUTTON_DEBOUNCE_MS * 1000 - quiet_us; // positive = from now
+    }
+
+    b->debounce_alarm = 0;
+
+    bool pressed = !gpio_get(b->gpio); // pulled up, pressed reads low
+    if (pressed == b->pressed) {
+        return 0; // a glitch that settled back where it was
+    }
+    b->pressed = pressed;
+
+    // stamp with the first edge of the burst, that's when the contact was made or broken
+    uint64_t edge_us = b->burst_us;
+
+    if (pressed) {
+        b->press_us = edge_us;
+        post_button_event(EV_BUTTON_PRESS, b, edge_us);
+
+        uint32_t held_ms = (uint32_t)((time_us_64() - edge_us) / 1000);
+        uint32_t long_ms = held_ms < LONG_PRESS_DURATION ? LONG_PRESS_DURATION - held_ms : 1;
+        b->long_alarm = add_alarm_in_ms(long_ms, long_press_callback, b, true);
+        if (b->long_alarm < 0) {
+            b->long_alarm = 0;
+        }
+    } else {
+        if (b->long_alarm > 0) {
+            cancel_alarm(b->long_alarm);
+            b->long_alarm = 0;
+        }
+        post_button_event(EV_BUTTON_RELEASE, b, edge_us);
+    }
+
+    return 0;
+}
+
+/**
+ call from the shared gpio irq callback, returns false if gpio isn't a button
+ */
+bool buttons_gpio_irq(uint32_t gpio, uint32_t mask) {
+    button_t *b = find_button(gpio);
+    if (b == NULL) {
+        return false;
+    }
+
+    b->last_edge_us = time_us_32();
+
+    // one alarm per bounce burst, it extends itself while edges keep coming
+    if (b->debounce_alarm <= 0) {
+        b->burst_us = time_us_64();
+        b->debounce_alarm = add_alarm_in_ms(BUTTON_DEBOUNCE_MS, debounce_callback, b, true);
+    }
+
+    return true;
+}
+
+/**
+ pins and edge irqs. gpio_set_irq_callback() has to be set up by the caller, there's
+ only one per core and the sensors share it
+ */
+void buttons_init(void) {
+    for (uint i = 0; i < BUTTON_COUNT; i++) {
+        gpio_init(buttons[i].gpio);
+        gpio_set_dir(buttons[i].gpio, GPIO_IN);
+        gpio_pull_up(buttons[i].gpio);
+
+        buttons[i].pressed = !gpio_get(buttons[i].gpio);
+        gpio_set_irq_enabled(buttons[i].gpio, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+    }
+}
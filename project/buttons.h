@@ -0,0 +1,13 @@
+// buttons.h
+// interrupt driven buttons, press / release / long press land in the events queue
+
+#ifndef BUTTONS_H
+#define BUTTONS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void buttons_init(void);
+bool buttons_gpio_irq(uint32_t gpio, uint32_t mask);
+
+#endif //BUTTONS_H
@@ -4,8 +4,6 @@
 #define CONFIG_H
 
 
-#include <pico/util/queue.h>
-
 #include "pico/time.h"
 #include "config.h"
 
@@ -30,32 +28,57 @@
 #define TIME_BETWEEN_PILLS  30000 // for testing purposes the pills are dispensed now every Xs, to change it to 30s
 #define FIRST_PILL_DELAY    30000 // make them both 30000
 
+#define STEP_INTERVAL_US    1000   // half-step period for homing, 1 kHz is what the motor is proven at
+
+// homing: ramp up to cruise until the opto edge, back off, then creep back onto it
+#define HOMING_MAX_STEPS        10000  // give up if there's no edge within this many steps
+#define HOMING_BACKOFF_STEPS    64     // past the edge on top of the fast phase's overshoot
+#define HOMING_SLOW_INTERVAL_US 3000   // creep speed for the final approach
+
+// motion profile defaults, stored with the calibration
+#define MOTION_START_SPS    1000   // start/stop speed without ramping, steps/s
+#define MOTION_MAX_SPS      1600   // cruise speed, steps/s
+#define MOTION_ACCEL_SPS2   4000   // steps/s^2
+#define MOTION_MIN_SPS      100
+#define MOTION_RAMP_MAX     512    // longest ramp we keep a timing table for
+#define MOTION_BACKLASH_STEPS 16   // gearbox slack taken up when the direction changes
+
 #define MAX_PILLS           7
 #define COMPARTMENTS        8
 #define COMPARTMENT_OFFSET 150
+#define CALIBRATION_REVOLUTIONS 3  // revolutions averaged by calibrate()
 #define ERROR_BLINK_COUNT   5
 #define LONG_PRESS_DURATION 2000   // 2 seconds
+#define BUTTON_DEBOUNCE_MS  20
+#define WAIT_CAL_BLINK_MS   200
+#define FIRST_DELAY_PULSE_MS 1000 // fade up and down while waiting for the first pill
 #define PIEZO_DEBOUNCE_MS   1000   // 1 second debounce for piezo sensor
+#define PIEZO_SAMPLE_HZ     10000  // ADC rate for the piezo detector
+#define PIEZO_BLOCK_SAMPLES 256    // per DMA buffer, 25.6 ms at 10 kHz
+#define DETECTION_TIMEOUT_MS 1000  // how long we wait for the pill after the move, at most
+#define DETECT_ARM_LEAD_STEPS 64   // steps before alignment the hole starts to open
+#define DETECT_WINDOW_MIN_MS 150   // adaptive window never goes below this
+#define DETECT_WINDOW_LEARN  3     // drops seen before the window adapts
 
 
 // eeprom config
 #define EEPROM_ADDR           0x50    // I2C address
 #define EEPROM_SIZE           32768    // size in bytes?
 #define EEPROM_PAGE_SIZE      64      // how many pages
-#define EEPROM_WRITE_TIMEOUT  5       // wait for write cycle
-
-// state storage addresses
-#define ADDR_MAGIC            0       // magic number to check if EEPROM is initialized (4 bytes)
-#define ADDR_CALIBRATED       4       // calibration flag (1 byte)
-#define ADDR_CURRENT_STEP     5       // current step position (4 bytes)
-#define ADDR_PILLS_DISPENSED  9       // pills dispensed (4 bytes)
-#define ADDR_STEPS_ROTATION   13      // steps per rotation (4 bytes)
-#define ADDR_STEPS_COMPARTMENT 17     // steps per compartment (4 bytes)
-#define ADDR_DISPENSING_IN_PROGRESS 25
+#define EEPROM_WRITE_TIMEOUT  5       // worst case write cycle (tWC) in ms
+#define EEPROM_ACK_POLL_DEADLINE_US 10000  // give up ACK polling after this, 2x tWC
+#define EEPROM_VERBOSE_LOAD   0       // 1 = dump every restored field over UART at boot
+#define EEPROM_LATENCY_BUCKETS 6      // 1 ms wide write latency buckets, last one is 5 ms+
 
+// state journal: append-only ring of page sized, CRC protected records spread over the
+// whole device. every save goes to the slot after the newest one, so a torn write never
+// touches the last good record
+#define JOURNAL_SLOT_SIZE     EEPROM_PAGE_SIZE
+#define JOURNAL_SLOTS         (EEPROM_SIZE / JOURNAL_SLOT_SIZE)
 
 // magic number to validate EEPROM content
 #define EEPROM_MAGIC_NUMBER   0xABC123  // no difference
+#define EEPROM_STATE_VERSION  3         // bump whenever the record layout changes
 
 #define LORA_TEST "AT"
 
@@ -66,9 +89,20 @@
 
 #define LORAWAN_BAUD_RATE 9600
 #define LORAWAN_TIMEOUT_MS 500
-#define LORAWAN_MAX_TRIES 1
+#define LORAWAN_JOIN_TIMEOUT_MS 20000  // AT+JOIN to +JOIN: Done
 #define STRLEN 1024
 
+#define LORAWAN_RX_RING_SIZE 256     // uart rx ring, power of two
+#define LORAWAN_EVENT_RING_SIZE 32    // core 0 -> core 1 uplink events, power of two
+#define LORAWAN_STATUS_HISTORY 64     // how many recent event ids lorawan_message_status() remembers
+#define LORAWAN_CORE1_IDLE_MS 100     // core 1 sleeps at most this long when there's nothing to send
+#define LORAWAN_TX_QUEUE_LEN 8        // outbound frames waiting for the modem
+#define LORAWAN_EVENT_COALESCE_MS 1000 // hold a fresh frame this long so nearby events share it
+#define LORAWAN_MSG_DONE_TIMEOUT_MS 10000 // modem's +MSG: Done window
+#define LORAWAN_BACKOFF_BASE_MS 2000      // first retry after a failed join, doubles every time
+#define LORAWAN_BACKOFF_MAX_MS 300000     // never wait longer than this between tries
+#define LORAWAN_LINK_FAIL_LIMIT 3         // uplinks failed in a row before the link counts as lost
+
 #define LORAWAN_MODE "AT+MODE=LWOTAA"
 #define LORAWAN_KEY "AT+KEY=APPKEY,\"44F649EDCE50703B29776CE6CFFB46F4\""
 #define LORAWAN_CLASS "AT+CLASS=A"
@@ -82,24 +116,24 @@
 #define LORAWAN_PORT_OUTCOME "+PORT: 8"
 
 extern int steps_per_rotation;
-extern int steps_per_compartment;
+extern int steps_per_compartment;          // rounded, for display and sanity checks
+extern int32_t steps_per_compartment_q16;  // Q16.16, what moves are actually planned from
 extern int current_step;
 extern bool calibrated;
 extern bool dispense_pill_flag;
 extern bool led_blink_flag;
-extern bool lorawan_connected;
+extern volatile bool lorawan_connected;  // written by core 1
 extern bool eeprom_initialized;
 extern int pills_dispensed;
 extern int dispensing_in_progress;
 
 
 // timestamping
-extern uint32_t last_led_toggle;
-extern uint32_t last_piezo_time;
 extern uint32_t first_delay_start;
 
-// queue & timer
-extern queue_t events;
+// events & timer
+#define EVENT_RING_SIZE 32  // irq -> main loop events, power of two
+#define TRACE_RING_SIZE 256 // span begin/end entries kept per core, power of two
 extern struct repeating_timer timer;
 
 // System states
@@ -113,14 +147,22 @@ typedef enum {
 
 // event types
 typedef enum {
-    EV_OPTO,
-    EV_PIEZO
+    EV_PIEZO,           // data = detection confidence 0-100
+    EV_MOTION_DONE,
+    EV_BUTTON_PRESS,    // data = gpio of the button
+    EV_BUTTON_RELEASE,
+    EV_BUTTON_LONG_PRESS,
+    EV_FIRST_DELAY_DONE,
+    EV_DISPENSE_TICK,
+    EV_DETECT_TIMEOUT,
+    EV_TYPE_COUNT
 } event_type_t;
 
 // event structure
 typedef struct {
     event_type_t type;
-    uint32_t timestamp;
+    uint32_t data;
+    uint64_t timestamp_us;  // time_us_64() when it happened
 } event_t;
 
 
@@ -0,0 +1,71 @@
+// cpu_load.c
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/platform.h"
+#include "cpu_load.h"
+
+// 32 bit microsecond counters so the other core always reads a whole value, differences
+// stay right across the 71 minute wrap. each core only writes its own slot
+static volatile uint32_t idle_us[2] = {0};
+static uint32_t idle_start[2] = {0};
+static volatile uint32_t wakeups[2] = {0};
+
+// where the current window started, only touched by whoever calls cpu_load_report()
+static uint32_t window_start = 0;
+static uint32_t window_idle_start[2] = {0};
+static uint32_t window_wakeups_start[2] = {0};
+
+void cpu_load_idle_begin(void) {
+    idle_start[get_core_num()] = time_us_32();
+}
+
+void cpu_load_idle_end(void) {
+    uint core = get_core_num();
+    idle_us[core] += time_us_32() - idle_start[core];
+}
+
+/**
+ call after each wfi/wfe so the report can show how often the core gets woken
+ */
+void cpu_load_count_wakeup(void) {
+    wakeups[get_core_num()]++;
+}
+
+/**
+ idle time per core since the last report
+ */
+cpu_load_t cpu_load_get(void) {
+    cpu_load_t load = {
+        .window_us = time_us_32() - window_start,
+        .idle_us = { idle_us[0] - window_idle_start[0], idle_us[1] - window_idle_start[1] },
+        .wakeups = { wakeups[0] - window_wakeups_start[0], wakeups[1] - window_wakeups_start[1] }
+    };
+    return load;
+}
+
+/**
+ print busy/idle percentage and wakeup rate per core since the last report and start a new window
+ */
+void cpu_load_report(void) {
+    cpu_load_t load = cpu_load_get();
+
+    if (load.window_us == 0) {
+        return;
+    }
+
+    for (int core = 0; core < 2; core++) {
+        uint32_t idle = load.idle_us[core] < load.window_us ? load.idle_us[core] : load.window_us;
+        uint32_t busy_permille = (uint32_t)((uint64_t)(load.window_us - idle) * 1000 / load.window_us);
+        uint32_t wakeups_per_s = (uint32_t)((uint64_t)load.wakeups[core] * 1000000 / load.window_us);
+        printf("Core %d busy: %u.%u%%, idle %u.%u%% of %u ms, %u wakeups/s\n", core,
+               busy_permille / 10, busy_permille % 10, (1000 - busy_permille) / 10, (1000 - busy_permille) % 10,
+               load.window_us / 1000, wakeups_per_s);
+    }
+
+    window_start += load.window_us;
+    window_idle_start[0] += load.idle_us[0];
+    window_idle_start[1] += load.idle_us[1];
+    window_wakeups_start[0] += load.wakeups[0];
+    window_wakeups_start[1] += load.wakeups[1];
+}
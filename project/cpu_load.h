@@ -0,0 +1,21 @@
+// cpu_load.h
+// per core busy/idle accounting, each core reports the time it spends waiting
+
+#ifndef CPU_LOAD_H
+#define CPU_LOAD_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t window_us;     // length of the measuring window
+    uint32_t idle_us[2];    // time each core spent waiting in it
+    uint32_t wakeups[2];    // times each core came out of wfi/wfe in it
+} cpu_load_t;
+
+void cpu_load_idle_begin(void);
+void cpu_load_idle_end(void);
+void cpu_load_count_wakeup(void);
+cpu_load_t cpu_load_get(void);
+void cpu_load_report(void);
+
+#endif //CPU_LOAD_H
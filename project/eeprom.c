@@ -1,5 +1,6 @@
 //eeprom.c
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include "hardware/i2c.h"
@@ -9,10 +10,408 @@
 
 #include "lorawan.h"
 #include "motor.h"
+#include "motion_profile.h"
+#include "leds.h"
+#include "trace.h"
+
+// RAM copy of the newest record in the journal, lets saves skip when nothing changed
+static eeprom_state_record_t state_shadow;
+static bool shadow_valid = false;
+
+static eeprom_journal_info_t journal = { .head = -1 };
+
+// the part of a record the boot scan reads to order slots
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t seq;
+    uint8_t version;
+} journal_header_t;
+
+_Static_assert(offsetof(eeprom_state_record_t, seq) == offsetof(journal_header_t, seq), "header must prefix the record");
+_Static_assert(offsetof(eeprom_state_record_t, version) == offsetof(journal_header_t, version), "header must prefix the record");
+
+static eeprom_stats_t eeprom_stats = {0};
+static eeprom_latency_t write_latency = { .min_us = UINT32_MAX };
+
+/**
+ build a record from the current globals
+ */
+static void state_to_record(eeprom_state_record_t *rec) {
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = EEPROM_MAGIC_NUMBER;
+    rec->version = EEPROM_STATE_VERSION;
+    rec->calibrated = calibrated ? 1 : 0;
+    rec->dispensing_in_progress = dispensing_in_progress ? 1 : 0;
+    rec->current_step = (uint8_t)current_step;
+    rec->pills_dispensed = pills_dispensed;
+    rec->steps_per_rotation = steps_per_rotation;
+    rec->steps_per_compartment = steps_per_compartment;
+    rec->steps_per_compartment_q16 = steps_per_compartment_q16;
+
+    // position and intent go in the same record, so they can't disagree after a power cut
+    rec->position = motion_position();
+    rec->target_position = motion_target();
+    rec->position_valid = motion_position_valid() ? 1 : 0;
+
+    motion_params_t motion = motion_get_params();
+    rec->motion_start_sps = motion.start_sps;
+    rec->motion_max_sps = motion.max_sps;
+    rec->motion_accel_sps2 = motion.accel_sps2;
+
+    lorawan_session_t session = lorawan_get_session();
+    rec->lorawan_session = session.state;
+    rec->lorawan_config_hash = session.config_hash;
+}
+
+/**
+ true if the data in two records differs. seq and crc are journal bookkeeping, everything
+ from version up to the crc is data (the reserved bytes are always zero)
+ */
+static bool record_changed(const eeprom_state_record_t *a, const eeprom_state_record_t *b) {
+    size_t start = offsetof(eeprom_state_record_t, version);
+
+    return memcmp((const uint8_t*)a + start, (const uint8_t*)b + start,
+                  offsetof(eeprom_state_record_t, crc) - start) != 0;
+}
+
+void eeprom_stats_reset(void) {
+    memset(&eeprom_stats, 0, sizeof(eeprom_stats));
+}
+
+eeprom_stats_t eeprom_get_stats(void) {
+    return eeprom_stats;
+}
+
+eeprom_journal_info_t eeprom_get_journal_info(void) {
+    return journal;
+}
+
+/**
+ CRC-32 (IEEE, reflected) with a 16 entry nibble table, small and fast enough for 60 bytes
+ */
+static uint32_t crc32(const uint8_t *data, size_t len) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+
+    return ~crc;
+}
+
+static uint32_t record_crc(const eeprom_state_record_t *rec) {
+    return crc32((const uint8_t*)rec, offsetof(eeprom_state_record_t, crc));
+}
+
+static uint16_t journal_slot_addr(int slot) {
+    return (uint16_t)(slot * JOURNAL_SLOT_SIZE);
+}
+
+// newer-than with wraparound, seq never realistically wraps but this costs nothing
+static bool seq_newer_or_equal(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) >= 0;
+}
+
+typedef enum {
+    SLOT_BLANK,     // never written, the chip comes erased to 0xFF
+    SLOT_VALID,     // one of our records (for a header probe: looks like one)
+    SLOT_BAD        // torn write, bit rot, another layout or someone else's data
+} slot_kind_t;
+
+static bool all_erased(const uint8_t *bytes, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (bytes[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ read just the header of a slot, bus errors are reported through bus_ok
+ */
+static slot_kind_t journal_probe(i2c_inst_t *i2c, int slot, uint32_t *seq, bool *bus_ok) {
+    journal_header_t hdr;
+
+    if (!eeprom_read_bytes(i2c, journal_slot_addr(slot), (uint8_t*)&hdr, sizeof(hdr))) {
+        *bus_ok = false;
+        return SLOT_BAD;
+    }
+
+    if (hdr.magic != EEPROM_MAGIC_NUMBER || hdr.version != EEPROM_STATE_VERSION) {
+        return all_erased((const uint8_t*)&hdr, sizeof(hdr)) ? SLOT_BLANK : SLOT_BAD;
+    }
+
+    *seq = hdr.seq;
+    return SLOT_VALID;
+}
+
+/**
+ sort a whole record that was read from a slot, a torn write fails the CRC
+ */
+static slot_kind_t record_kind(const eeprom_state_record_t *rec) {
+    if (rec->magic == EEPROM_MAGIC_NUMBER && rec->version == EEPROM_STATE_VERSION &&
+        rec->crc == record_crc(rec)) {
+        return SLOT_VALID;
+    }
+    return all_erased((const uint8_t*)rec, sizeof(*rec)) ? SLOT_BLANK : SLOT_BAD;
+}
+
+/**
+ overwrite a bad slot with the erased pattern so the next boot's binary search reads it as
+ blank (older than anything) instead of falling back to a full scan again. only safe once
+ the log is anchored at slot 0, when every other slot is behind head
+ */
+static void journal_blank_slot(i2c_inst_t *i2c, int slot) {
+    uint8_t blank[JOURNAL_SLOT_SIZE];
+
+    memset(blank, 0xFF, sizeof(blank));
+    if (eeprom_write_bytes(i2c, journal_slot_addr(slot), blank, sizeof(blank))) {
+        printf("EEPROM journal: cleared bad slot %d\n", slot);
+    }
+}
+
+/**
+ write rec into the given slot with the next sequence number
+ the slot is never the one holding the newest record, so a power cut here leaves the
+ previous state intact and the half written slot just fails its CRC on the next boot
+ */
+static bool journal_write_slot(i2c_inst_t *i2c, int slot, eeprom_state_record_t *rec) {
+    rec->magic = EEPROM_MAGIC_NUMBER;
+    rec->version = EEPROM_STATE_VERSION;
+    rec->seq = journal.seq + 1;
+    rec->crc = record_crc(rec);
+
+    if (!eeprom_write_bytes(i2c, journal_slot_addr(slot), (const uint8_t*)rec, sizeof(*rec))) {
+        return false;
+    }
+
+    journal.head = slot;
+    journal.seq = rec->seq;
+    return true;
+}
+
+static bool journal_append(i2c_inst_t *i2c, eeprom_state_record_t *rec) {
+    return journal_write_slot(i2c, (journal.head + 1) % JOURNAL_SLOTS, rec);
+}
+
+/**
+ re-anchor the log: copy the newest record into slot 0 with a fresh sequence number
+ after this slot 0 is the newest and everything after it is older, which is exactly the
+ shape the binary search in journal_scan() expects. only needed after a torn wrap-around
+ write or a corrupted slot, so slot 0 doesn't take any noticeable extra wear
+ */
+static bool journal_compact(i2c_inst_t *i2c) {
+    if (journal.head <= 0) {
+        return true; // empty, or already anchored at slot 0
+    }
+
+    eeprom_state_record_t rec = state_shadow;
+
+    if (!journal_write_slot(i2c, 0, &rec)) {
+        printf("EEPROM journal compaction failed\n");
+        return false;
+    }
+
+    state_shadow = rec;
+    journal.compactions++;
+    printf("EEPROM journal compacted\n");
+    return true;
+}
+
+/**
+ slow path: read every slot header and take the newest record that passes its CRC
+ */
+static bool journal_linear_scan(i2c_inst_t *i2c) {
+    static uint32_t slot_seq[JOURNAL_SLOTS]; // 0 = nothing usable, seq starts at 1
+    bool bus_ok = true;
+
+    printf("EEPROM journal: full scan\n");
+
+    for (int i = 0; i < JOURNAL_SLOTS; i++) {
+        uint32_t seq = 0;
+        slot_seq[i] = journal_probe(i2c, i, &seq, &bus_ok) == SLOT_VALID ? seq : 0;
+        if (!bus_ok) return false;
+    }
+
+    while (true) {
+        int best = -1;
+        for (int i = 0; i < JOURNAL_SLOTS; i++) {
+            if (slot_seq[i] != 0 && (best < 0 || slot_seq[i] > slot_seq[best])) {
+                best = i;
+            }
+        }
+
+        if (best < 0) {
+            journal.head = -1;
+            journal.seq = 0;
+            return true; // blank (or foreign) device
+        }
+
+        eeprom_state_record_t rec;
+        if (!eeprom_read_bytes(i2c, journal_slot_addr(best), (uint8_t*)&rec, sizeof(rec))) {
+            return false;
+        }
+        if (record_kind(&rec) == SLOT_VALID) {
+            journal.head = best;
+            journal.seq = rec.seq;
+            state_shadow = rec;
+            shadow_valid = true;
+            return journal_compact(i2c);
+        }
+
+        slot_seq[best] = 0; // torn or corrupted, try the next newest
+    }
+}
+
+/**
+ find the newest valid record
+ in a healthy log slots 0..head hold the current lap (seq >= slot 0) and the slots after
+ head are older or blank, so a binary search over header reads finds head in ~log2(512)
+ probes. a header that isn't ours and isn't blank stops the search. one that rotted into a
+ plausible seq can still steer it, but then the candidate or the slot right after it fails
+ its CRC, so both are read in full. anything that doesn't fit falls back to a full scan
+ plus compaction
+ */
+static bool journal_scan(i2c_inst_t *i2c) {
+    bool bus_ok = true;
+    uint32_t seq0;
+    int bad = -1;
+
+    shadow_valid = false;
+
+    if (journal_probe(i2c, 0, &seq0, &bus_ok) != SLOT_VALID) {
+        // blank device, a torn write while wrapping around to slot 0, or a bad slot 0
+        return bus_ok && journal_linear_scan(i2c);
+    }
+
+    int lo = 0;
+    int hi = JOURNAL_SLOTS - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        uint32_t seq;
+        slot_kind_t kind = journal_probe(i2c, mid, &seq, &bus_ok);
+        if (!bus_ok) return false;
+
+        if (kind == SLOT_BAD) {
+            bad = mid;
+            break;
+        }
+        if (kind == SLOT_VALID && seq_newer_or_equal(seq, seq0)) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    // one sequential burst: the candidate and the slot after it
+    eeprom_state_record_t burst[2];
+    if (bad < 0) {
+        size_t burst_len = (lo + 1 < JOURNAL_SLOTS) ? sizeof(burst) : sizeof(burst[0]);
+        if (!eeprom_read_bytes(i2c, journal_slot_addr(lo), (uint8_t*)burst, burst_len)) {
+            return false;
+        }
+
+        if (record_kind(&burst[0]) != SLOT_VALID) {
+            bad = lo;
+        } else if (burst_len == sizeof(burst)) {
+            // the slot after head has to be older or blank
+            slot_kind_t next = record_kind(&burst[1]);
+            if (next == SLOT_BAD) {
+                bad = lo + 1;
+            } else if (next == SLOT_VALID && seq_newer_or_equal(burst[1].seq, burst[0].seq + 1)) {
+                return journal_linear_scan(i2c);
+            }
+        }
+    }
+
+    if (bad >= 0) {
+        if (!journal_linear_scan(i2c)) {
+            return false;
+        }
+        if (journal.head <= 0 && bad != journal.head) {
+            journal_blank_slot(i2c, bad);
+        }
+        return true;
+    }
+
+    journal.head = lo;
+    journal.seq = burst[0].seq;
+    state_shadow = burst[0];
+    shadow_valid = true;
+    return true;
+}
+
+void eeprom_print_write_latency(void) {
+    if (write_latency.count == 0) {
+        printf("EEPROM write latency: no writes yet\n");
+        return;
+    }
+
+    printf("EEPROM write latency: min %u us, avg %u us, max %u us over %u writes (%u timeouts)\n",
+           write_latency.min_us, (uint32_t)(write_latency.total_us / write_latency.count),
+           write_latency.max_us, write_latency.count, write_latency.timeouts);
+
+    for (int i = 0; i < EEPROM_LATENCY_BUCKETS; i++) {
+        if (i == EEPROM_LATENCY_BUCKETS - 1) {
+            printf("  %d ms+: %u\n", i, write_latency.buckets[i]);
+        } else {
+            printf("  %d-%d ms: %u\n", i, i + 1, write_latency.buckets[i]);
+        }
+    }
+}
+
+/**
+ wait for the internal write cycle to finish by polling for an ACK
+ the chip NACKs its address while it's busy, so a 1 byte read only succeeds once it's done.
+ bounded by EEPROM_ACK_POLL_DEADLINE_US in case the chip never comes back
+ */
+static bool eeprom_wait_write_complete(i2c_inst_t *i2c) {
+    uint64_t start = time_us_64();
+    uint64_t elapsed = 0;
+    uint8_t dummy;
+    bool acked = false;
+
+    while (elapsed < EEPROM_ACK_POLL_DEADLINE_US) {
+        if (i2c_read_timeout_us(i2c, EEPROM_ADDR, &dummy, 1, false, 1000) == 1) {
+            acked = true;
+            break;
+        }
+        elapsed = time_us_64() - start;
+    }
+
+    elapsed = time_us_64() - start;
+
+    if (!acked) {
+        write_latency.timeouts++;
+        return false;
+    }
+
+    // record latency
+    uint32_t us = (uint32_t)elapsed;
+    write_latency.count++;
+    write_latency.total_us += us;
+    if (us < write_latency.min_us) write_latency.min_us = us;
+    if (us > write_latency.max_us) write_latency.max_us = us;
+
+    uint32_t bucket = us / 1000;
+    if (bucket >= EEPROM_LATENCY_BUCKETS) bucket = EEPROM_LATENCY_BUCKETS - 1;
+    write_latency.buckets[bucket]++;
+
+    return true;
+}
+
 void reset_calibration_values(i2c_inst_t *i2c) {
     calibrated = false;
     steps_per_rotation = 0;
     steps_per_compartment = 0;
+    steps_per_compartment_q16 = 0;
     pills_dispensed = 0;
     dispensing_in_progress = 0;
 
@@ -31,18 +430,22 @@ void reset_pill_count(i2c_inst_t *i2c) {
 }
 
 void load_eeprom_state(i2c_inst_t *eeprom_i2c, repeating_timer_callback_t pill_timer_callback) {
-    // load state from EEPROM if available
+    // load state from EEPROM if available. the reads happened in init_eeprom(), this
+    // only decodes the record journal_scan() left in the shadow
     if (eeprom_initialized && load_state_from_eeprom(eeprom_i2c)) {
+        printf("State restored: journal scan %u us, %u ms after boot\n",
+               journal.scan_us, (uint32_t)(time_us_64() / 1000));
+
         if (calibrated && steps_per_rotation > 0 && steps_per_compartment > 0) {
             printf("Restored calibration from EEPROM\n");
-            lorawan_send_text(lorawan_connected, "Restored calibration from EEPROM");
+            lorawan_send_event(UPLINK_EV_STATE_RESTORED, pills_dispensed);
 
             if (pills_dispensed > 0 && pills_dispensed < MAX_PILLS || dispensing_in_progress == 1) {
                 // defining an "interrupted dispensing cycle" as either being in the middle of a motor turn
                 // OR having dispensed at least 1 pill but not all of them.
                 // recover from interrupted dispensing cycle
                 printf("Program interrupted, recovering...\n");
-                lorawan_send_text(lorawan_connected, "Recovering from interruption");
+                lorawan_send_event(UPLINK_EV_RECOVERING, pills_dispensed);
                 // printf("Resuming from pill %d of %d\n", pills_dispensed + 1, MAX_PILLS);
 
 
@@ -50,19 +453,27 @@ void load_eeprom_state(i2c_inst_t *eeprom_i2c, repeating_timer_callback_t pill_t
 
                 // update state to start dispensing next pill
                 state = S_DISPENSE;
-                dispense_pill_flag = true; // immediately start dispensing next pill
 
-                gpio_put(CENTER_LED, 1);
-                dispensing_in_progress = 0;
+                led_set(CENTER_LED, true);
                 add_repeating_timer_ms(TIME_BETWEEN_PILLS, pill_timer_callback, NULL, &timer);
 
-                recalibrate_motor();
+                // stopped between dispenses with the position saved: nothing to move, the
+                // next pill goes straight away. a move that was cut short rewinds to the opto
+                // fork and replays, the end of that move decides about the next pill
+                uint64_t recover_start = time_us_64();
+                if (dispensing_in_progress == 0 && motion_resume()) {
+                    printf("Position %d still valid, skipping re-home\n", motion_position());
+                    dispense_pill_flag = true;
+                } else {
+                    recalibrate_motor();
+                }
+                printf("Recovery started in %u ms\n", (uint32_t)((time_us_64() - recover_start) / 1000));
 
 
             } else {
                 // EEPROM had calibration, but no interrupted dispense
                 state = S_IDLE;
-                gpio_put(CENTER_LED, 1);  // show calibrated status
+                led_set(CENTER_LED, true);  // show calibrated status
                 printf("Ready to dispense. Press LEFT button.\n");
             }
         } else {
@@ -111,96 +522,111 @@ bool init_eeprom(i2c_inst_t *i2c) {
         return false;
     }
 
-    // check for magic number to see if EEPROM has been initialized
-    uint32_t magic = 0;
-    bool read_result = eeprom_read_bytes(i2c, ADDR_MAGIC, (uint8_t*)&magic, sizeof(magic));
-
-    if (!read_result) {
-        printf("Failed to read magic number from EEPROM\n");
+    // find the newest record in the journal
+    uint64_t scan_start = time_us_64();
+    bool scanned = journal_scan(i2c);
+    journal.scan_us = (uint32_t)(time_us_64() - scan_start);
+    if (!scanned) {
+        printf("Failed to scan EEPROM journal\n");
         return false;
     }
 
-    // printf("Read magic number: 0x%08X, Expected: 0x%08X\n", magic, EEPROM_MAGIC_NUMBER);
-
-    if (magic != EEPROM_MAGIC_NUMBER) {
+    if (journal.head < 0) {
         printf("EEPROM not initialized. Setting up...\n");
-        // write magic number to initialize
-        magic = EEPROM_MAGIC_NUMBER;
-        bool write_result = eeprom_write_bytes(i2c, ADDR_MAGIC, (uint8_t*)&magic, sizeof(magic));
+        // first record built from the (default) globals
+        eeprom_state_record_t rec;
+        state_to_record(&rec);
 
-        if (!write_result) {
-            printf("Failed to write magic number to EEPROM\n");
+        if (!journal_append(i2c, &rec)) {
+            printf("Failed to write state record to EEPROM\n");
             return false;
         }
 
-        // printf("Magic number written successfully\n");
+        state_shadow = rec;
+        shadow_valid = true;
     }
 
+    printf("EEPROM journal: newest record in slot %d (seq %u)\n", journal.head, journal.seq);
+
     printf("EEPROM initialized\n");
     return true;
 }
 
 bool save_state_to_eeprom(i2c_inst_t *i2c) {
-    // globals
-
-    bool success = true;
-    uint8_t cal_flag = calibrated ? 1 : 0;
+    eeprom_state_record_t rec;
+    state_to_record(&rec);
 
-    // save calibration flag
-    success &= eeprom_write_bytes(i2c, ADDR_CALIBRATED, &cal_flag, sizeof(cal_flag));
+    if (shadow_valid && !record_changed(&rec, &state_shadow)) {
+        // nothing changed since the last save, don't touch the bus
+        eeprom_stats.saves_skipped++;
+        return true;
+    }
 
-    // save numerical values
-    // printf("Steps per rotation %d\nSteps per compartment: %d\n", steps_per_rotation, steps_per_compartment);
-    success &= eeprom_write_bytes(i2c, ADDR_CURRENT_STEP, (uint8_t*)&current_step, sizeof(current_step));
-    success &= eeprom_write_bytes(i2c, ADDR_PILLS_DISPENSED, (uint8_t*)&pills_dispensed, sizeof(pills_dispensed));
-    success &= eeprom_write_bytes(i2c, ADDR_STEPS_ROTATION, (uint8_t*)&steps_per_rotation, sizeof(steps_per_rotation));
-    success &= eeprom_write_bytes(i2c, ADDR_STEPS_COMPARTMENT, (uint8_t*)&steps_per_compartment, sizeof(steps_per_compartment));
-    success &= eeprom_write_bytes(i2c, ADDR_DISPENSING_IN_PROGRESS, (uint8_t*)&dispensing_in_progress, sizeof(dispensing_in_progress));
+    // append a whole record to the next slot, one page write
+    bool success = journal_append(i2c, &rec);
 
     if (success) {
+        state_shadow = rec;
+        shadow_valid = true;
         printf("State saved to EEPROM\n");
     } else {
+        // the slot we tried is garbage now but the previous record is untouched,
+        // force a write next time even if nothing else changes
+        shadow_valid = false;
         printf("Failed to save EEPROM state\n");
     }
 
     return success;
 }
 
-bool load_state_from_eeprom(i2c_inst_t *i2c) {
-    // define globals
-    uint32_t magic;
-    bool read_magic = eeprom_read_bytes(i2c, ADDR_MAGIC, (uint8_t*)&magic, sizeof(magic));
-
-    if (!read_magic) {
-        printf("Failed to read magic number\n");
+/**
+ the LoRaWAN session in the newest record, from the RAM copy like load_state_from_eeprom()
+ core 1 needs it before the rest of the state is restored
+ */
+bool eeprom_get_lorawan_session(lorawan_session_t *session) {
+    if (journal.head < 0 || !shadow_valid) {
         return false;
     }
 
-    if (magic != EEPROM_MAGIC_NUMBER) {
-        printf("EEPROM magic number doesn't match\n");
+    session->state = state_shadow.lorawan_session;
+    session->config_hash = state_shadow.lorawan_config_hash;
+    return true;
+}
+
+bool load_state_from_eeprom(i2c_inst_t *i2c) {
+    // the newest record was burst read and CRC checked by journal_scan() during
+    // init_eeprom(), so restoring is just decoding the RAM copy, no bus traffic
+    if (journal.head < 0 || !shadow_valid) {
+        printf("No state record in EEPROM\n");
         return false;
     }
 
-    uint8_t cal_flag;
-    bool read_success = true;
+    const eeprom_state_record_t *rec = &state_shadow;
 
-    read_success &= eeprom_read_bytes(i2c, ADDR_CALIBRATED, &cal_flag, sizeof(cal_flag));
-    read_success &= eeprom_read_bytes(i2c, ADDR_CURRENT_STEP, (uint8_t*)&current_step, sizeof(current_step));
-    read_success &= eeprom_read_bytes(i2c, ADDR_PILLS_DISPENSED, (uint8_t*)&pills_dispensed, sizeof(pills_dispensed));
-    read_success &= eeprom_read_bytes(i2c, ADDR_STEPS_ROTATION, (uint8_t*)&steps_per_rotation, sizeof(steps_per_rotation));
-    read_success &= eeprom_read_bytes(i2c, ADDR_STEPS_COMPARTMENT, (uint8_t*)&steps_per_compartment, sizeof(steps_per_compartment));
-    read_success &= eeprom_read_bytes(i2c, ADDR_DISPENSING_IN_PROGRESS, (uint8_t*)&dispensing_in_progress, sizeof(dispensing_in_progress));
+    calibrated = (rec->calibrated != 0);
+    current_step = rec->current_step % COMPARTMENTS;
+    pills_dispensed = rec->pills_dispensed;
+    steps_per_rotation = rec->steps_per_rotation;
+    steps_per_compartment = rec->steps_per_compartment;
+    dispensing_in_progress = rec->dispensing_in_progress;
 
-    if (!read_success) {
-        printf("Failed to read state values from EEPROM\n");
-        return false;
-    }
+    // records from before the fixed point value only have the whole steps
+    steps_per_compartment_q16 = rec->steps_per_compartment_q16 != 0 ?
+                                rec->steps_per_compartment_q16 : (int32_t)steps_per_compartment << 16;
+
+    // only trusted together with the calibration it was measured against
+    motion_restore_position(rec->position, rec->target_position, calibrated && rec->position_valid);
 
-    calibrated = (cal_flag != 0);
+    // motion limits go with the calibration, records from before they existed have zeros
+    if (rec->motion_start_sps != 0) {
+        motion_params_t motion = { rec->motion_start_sps, rec->motion_max_sps, rec->motion_accel_sps2 };
+        motion_set_params(motion);
+    }
 
     // prevent impossible step values
     if (steps_per_rotation > 10000 || steps_per_rotation < 0 ||
-        steps_per_compartment > 2000 || steps_per_compartment < 0) {
+        steps_per_compartment > 2000 || steps_per_compartment < 0 ||
+        steps_per_compartment_q16 > (2000 << 16) || steps_per_compartment_q16 < 0) {
         printf("Invalid step values in EEPROM, resetting to defaults\n");
         reset_calibration_values(i2c);
         return false;
@@ -210,21 +636,28 @@ bool load_state_from_eeprom(i2c_inst_t *i2c) {
     if (!calibrated) {
         steps_per_rotation = 0;
         steps_per_compartment = 0;
+        steps_per_compartment_q16 = 0;
         pills_dispensed = 0;
         dispensing_in_progress = 0;
     }
 
+#if EEPROM_VERBOSE_LOAD
     printf("State loaded from EEPROM\n");
     printf("  Calibrated: %s\n", calibrated ? "Yes" : "No");
     printf("  Current step: %d\n", current_step);
     printf("  Pills dispensed: %d\n", pills_dispensed);
     printf("  Steps per rotation: %d\n", steps_per_rotation);
-    printf("  Steps per compartment: %d\n", steps_per_compartment);
+    printf("  Steps per compartment: %d (Q16.16 0x%08x)\n", steps_per_compartment, steps_per_compartment_q16);
     printf("  Dispensing in progress: %s\n", dispensing_in_progress ? "Yes" : "No");
+#else
+    printf("State loaded from EEPROM (cal %d, pills %d, busy %d)\n", calibrated, pills_dispensed, dispensing_in_progress);
+#endif
     return true;
 }
 
 bool eeprom_write_bytes(i2c_inst_t *i2c, uint16_t addr, const uint8_t *data, size_t len) {
+    TRACE_BEGIN(TRACE_EEPROM_WRITE);
+
     // EEPROM writes page boundaries
     size_t bytes_written = 0;
 
@@ -248,19 +681,29 @@ bool eeprom_write_bytes(i2c_inst_t *i2c, uint16_t addr, const uint8_t *data, siz
 
         if (result != bytes_to_write + 2) {
             printf("EEPROM write failed at address 0x%04X: %d\n", current_addr, result);
+            TRACE_END(TRACE_EEPROM_WRITE);
             return false;
         }
 
+        eeprom_stats.i2c_bytes += bytes_to_write + 2;
+        eeprom_stats.write_cycles++;
+
         // wait for write cycle to complete
-        sleep_ms(EEPROM_WRITE_TIMEOUT);
+        if (!eeprom_wait_write_complete(i2c)) {
+            printf("EEPROM write cycle timed out at address 0x%04X\n", current_addr);
+            TRACE_END(TRACE_EEPROM_WRITE);
+            return false;
+        }
         bytes_written += bytes_to_write;
     }
 
+    TRACE_END(TRACE_EEPROM_WRITE);
     return true;
 }
 
 
 bool eeprom_read_bytes(i2c_inst_t *i2c, uint16_t addr, uint8_t *data, size_t len) {
+    TRACE_BEGIN(TRACE_EEPROM_READ);
 
     // read address
     uint8_t addr_buf[2];
@@ -272,6 +715,7 @@ bool eeprom_read_bytes(i2c_inst_t *i2c, uint16_t addr, uint8_t *data, size_t len
 
     if (write_result != 2) {
         printf("EEPROM address write failed: %d\n", write_result);
+        TRACE_END(TRACE_EEPROM_READ);
         return false;
     }
 
@@ -280,8 +724,12 @@ bool eeprom_read_bytes(i2c_inst_t *i2c, uint16_t addr, uint8_t *data, size_t len
 
     if (read_result != len) {
         printf("EEPROM read failed: %d\n", read_result);
+        TRACE_END(TRACE_EEPROM_READ);
         return false;
     }
 
+    eeprom_stats.i2c_bytes += 2 + len;
+
+    TRACE_END(TRACE_EEPROM_READ);
     return true;
 }
\ No newline at end of file
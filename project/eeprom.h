@@ -5,20 +5,79 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "config.h"
 #include "hardware/i2c.h"
+#include "lorawan.h"
 
+// packed state record, one per journal slot. magic, seq and version come first so the
+// boot scan can order slots from a short header read
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t seq;            // increments on every append, newest record wins
+    uint8_t version;
+    uint8_t calibrated;
+    uint8_t dispensing_in_progress;
+    uint8_t current_step;
+    int32_t pills_dispensed;
+    int32_t steps_per_rotation;
+    int32_t steps_per_compartment;
+    // fields below were carved out of reserved (zeroed) space, 0 means "not set, use defaults"
+    uint16_t motion_start_sps;
+    uint16_t motion_max_sps;
+    uint16_t motion_accel_sps2;
+    int32_t steps_per_compartment_q16;  // Q16.16
+    int32_t position;                   // steps from home at the last save
+    int32_t target_position;            // where the move in progress ends, == position when idle
+    uint8_t position_valid;
+    uint8_t lorawan_session;            // lorawan_session_state_t, what a warm boot can skip
+    uint32_t lorawan_config_hash;       // the configuration that session was made with
+    uint8_t reserved[JOURNAL_SLOT_SIZE - 52];
+    uint32_t crc;            // CRC-32 over everything above
+} eeprom_state_record_t;
+
+_Static_assert(sizeof(eeprom_state_record_t) == JOURNAL_SLOT_SIZE, "state record must fill one journal slot");
+_Static_assert(EEPROM_PAGE_SIZE % JOURNAL_SLOT_SIZE == 0, "journal slots must not straddle EEPROM pages");
+
+// bus traffic counters, reset at the start of every dispense
+typedef struct {
+    uint32_t i2c_bytes;      // bytes put on the bus, memory address bytes included
+    uint32_t write_cycles;   // page writes, each one costs an internal write cycle
+    uint32_t saves_skipped;  // saves that found nothing dirty in the shadow
+} eeprom_stats_t;
+
+// where the journal currently is
+typedef struct {
+    int head;                // slot holding the newest valid record, -1 if none
+    uint32_t seq;            // sequence number of that record
+    uint32_t compactions;    // times the log was re-anchored at slot 0 since boot
+    uint32_t scan_us;        // finding the head at boot, all of the I2C a restore costs
+} eeprom_journal_info_t;
+
+// write cycle latency histogram, measured by ACK polling after every page write
+typedef struct {
+    uint32_t count;
+    uint32_t timeouts;       // polls that hit EEPROM_ACK_POLL_DEADLINE_US
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t buckets[EEPROM_LATENCY_BUCKETS];
+} eeprom_latency_t;
 
 bool init_eeprom(i2c_inst_t *i2c);
 
 // prototypes
 bool save_state_to_eeprom(i2c_inst_t *i2c);
 bool load_state_from_eeprom(i2c_inst_t *i2c);
-bool check_need_recovery(void);
 void load_eeprom_state(i2c_inst_t *eeprom_i2c, repeating_timer_callback_t pill_timer_callback);
 void reset_calibration_values(i2c_inst_t *i2c);
 void reset_pill_count(i2c_inst_t *i2c);  // New function to reset only pill count
 bool eeprom_write_bytes(i2c_inst_t *i2c, uint16_t addr, const uint8_t *data, size_t len);
 bool eeprom_read_bytes(i2c_inst_t *i2c, uint16_t addr, uint8_t *data, size_t len);
+void eeprom_stats_reset(void);
+eeprom_stats_t eeprom_get_stats(void);
+eeprom_journal_info_t eeprom_get_journal_info(void);
+bool eeprom_get_lorawan_session(lorawan_session_t *session);
+void eeprom_print_write_latency(void);
 
 #ifdef __cplusplus
 }
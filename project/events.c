@@ -0,0 +1,75 @@
+// events.c
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "events.h"
+
+_Static_assert((EVENT_RING_SIZE & (EVENT_RING_SIZE - 1)) == 0, "event ring size must be a power of two");
+
+static event_t ring[EVENT_RING_SIZE];
+static volatile uint32_t ring_head = 0;    // written by the producers only
+static volatile uint32_t ring_tail = 0;    // written by the main loop only
+
+static events_stats_t stats;
+
+/**
+ add an event stamped with an explicit time, for irqs that know when it really happened
+ */
+bool events_post_at(event_type_t type, uint64_t timestamp_us, uint32_t data) {
+    uint32_t head = ring_head;
+    uint32_t waiting = head - ring_tail;
+
+    if (waiting >= EVENT_RING_SIZE) {
+        stats.overflows++;
+        if (type < EV_TYPE_COUNT) {
+            stats.dropped[type]++;
+        }
+        return false;
+    }
+
+    event_t *ev = &ring[head & (EVENT_RING_SIZE - 1)];
+    ev->type = type;
+    ev->timestamp_us = timestamp_us;
+    ev->data = data;
+
+    __dmb(); // event is written before the main loop sees the new head
+    ring_head = head + 1;
+
+    stats.posted++;
+    if (waiting + 1 > stats.high_water) {
+        stats.high_water = waiting + 1;
+    }
+    return true;
+}
+
+bool events_post(event_type_t type, uint32_t data) {
+    return events_post_at(type, time_us_64(), data);
+}
+
+/**
+ take the oldest event, main loop (core 0 thread) only
+ */
+bool events_pop(event_t *ev) {
+    uint32_t tail = ring_tail;
+    if (tail == ring_head) {
+        return false;
+    }
+
+    __dmb(); // see the event the irq wrote before it moved head
+    *ev = ring[tail & (EVENT_RING_SIZE - 1)];
+    __dmb(); // copied out before the slot is handed back
+    ring_tail = tail + 1;
+    return true;
+}
+
+bool events_empty(void) {
+    return ring_tail == ring_head;
+}
+
+void events_print_stats(void) {
+    printf("Events: %u posted, peak %u/%u, %u dropped (piezo %u)\n",
+           stats.posted, stats.high_water, EVENT_RING_SIZE, stats.overflows,
+           stats.dropped[EV_PIEZO]);
+}
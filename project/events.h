@@ -0,0 +1,25 @@
+// events.h
+// core 0 irq -> main loop event ring. lock free: every producer is a core 0 irq at the
+// default priority, so they can't preempt each other and together act as one producer
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+
+typedef struct {
+    uint32_t posted;
+    uint32_t overflows;                 // events dropped because the ring was full
+    uint32_t high_water;                // most events waiting at once
+    uint32_t dropped[EV_TYPE_COUNT];    // overflows by type, lost piezo hits show here
+} events_stats_t;
+
+bool events_post(event_type_t type, uint32_t data);
+bool events_post_at(event_type_t type, uint64_t timestamp_us, uint32_t data);
+bool events_pop(event_t *ev);
+bool events_empty(void);
+void events_print_stats(void);
+
+#endif //EVENTS_H
@@ -0,0 +1,183 @@
+// leds.c
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/time.h"
+#include "hardware/pwm.h"
+#include "hardware/sync.h"
+#include "config.h"
+#include "leds.h"
+
+// wrap at 16 bits with no divider is ~1.9 kHz, well past visible flicker
+#define LED_PWM_WRAP        0xFFFF
+#define LED_PULSE_STEP_MS   20
+
+typedef struct {
+    uint32_t gpio;
+    led_pattern_t pattern;
+    alarm_id_t alarm;
+    bool lit;               // blink/burst: which half we're in
+    uint16_t blinks_left;   // burst
+    uint16_t pulse_pos;     // pulse: ms into the current up+down cycle
+} led_t;
+
+static led_t leds[] = {
+    { .gpio = LEFT_LED },
+    { .gpio = CENTER_LED },
+    { .gpio = RIGHT_LED },
+};
+
+#define LED_COUNT (sizeof(leds) / sizeof(leds[0]))
+
+static led_t *find_led(uint32_t gpio) {
+    for (uint i = 0; i < LED_COUNT; i++) {
+        if (leds[i].gpio == gpio) {
+            return &leds[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ brightness is squared so fades look even to the eye, 255^2 just fits the wrap
+ */
+static void led_level(led_t *led, uint8_t brightness) {
+    pwm_set_gpio_level(led->gpio, (uint16_t)(brightness * brightness));
+}
+
+/**
+ pulse brightness at pulse_pos, a triangle between 0 and the pattern brightness
+ */
+static uint8_t pulse_brightness(const led_t *led) {
+    const led_pattern_t *p = &led->pattern;
+    uint32_t pos = led->pulse_pos;
+
+    if (pos < p->on_ms) {
+        return (uint8_t)(pos * p->brightness / p->on_ms);
+    }
+    pos -= p->on_ms;
+    return (uint8_t)((p->off_ms - pos) * p->brightness / p->off_ms);
+}
+
+/**
+ next segment of the pattern, runs in the timer irq. rescheduling is relative to when
+ the alarm was due so long patterns don't drift
+ */
+static int64_t led_alarm_callback(alarm_id_t id, void *user_data) {
+    led_t *led = user_data;
+    const led_pattern_t *p = &led->pattern;
+
+    switch (p->mode) {
+        case LED_BLINK:
+        case LED_BURST:
+            if (led->lit) {
+                led->lit = false;
+                led_level(led, 0);
+
+                if (p->mode == LED_BURST && --led->blinks_left == 0) {
+                    led->pattern.mode = LED_OFF;
+                    led->alarm = 0;
+                    return 0;
+                }
+                return -(int64_t)p->off_ms * 1000;
+            }
+            led->lit = true;
+            led_level(led, p->brightness);
+            return -(int64_t)p->on_ms * 1000;
+
+        case LED_PULSE:
+            led->pulse_pos = (led->pulse_pos + LED_PULSE_STEP_MS) % (p->on_ms + p->off_ms);
+            led_level(led, pulse_brightness(led));
+            return -(int64_t)LED_PULSE_STEP_MS * 1000;
+
+        default:
+            led->alarm = 0;
+            return 0;
+    }
+}
+
+/**
+ switch an LED to a new pattern, whatever it was doing. never blocks
+ */
+void led_set_pattern(uint32_t gpio, led_pattern_t pattern) {
+    led_t *led = find_led(gpio);
+    if (led == NULL) {
+        return;
+    }
+
+    // zero length segments would spin the alarm
+    if ((pattern.mode == LED_BLINK || pattern.mode == LED_BURST || pattern.mode == LED_PULSE) &&
+        (pattern.on_ms == 0 || pattern.off_ms == 0)) {
+        pattern.mode = LED_ON;
+    }
+    if (pattern.mode == LED_BURST && pattern.count == 0) {
+        pattern.mode = LED_OFF;
+    }
+
+    // the alarm irq runs on this core too, keep it out while the state is half written
+    uint32_t irq_state = save_and_disable_interrupts();
+
+    if (led->alarm > 0) {
+        cancel_alarm(led->alarm);
+        led->alarm = 0;
+    }
+
+    led->pattern = pattern;
+    led->lit = pattern.mode != LED_OFF;
+    led->blinks_left = pattern.count;
+    led->pulse_pos = 0;
+
+    uint32_t first_ms = 0;
+    switch (pattern.mode) {
+        case LED_OFF:
+            led_level(led, 0);
+            break;
+        case LED_ON:
+            led_level(led, pattern.brightness);
+            break;
+        case LED_BLINK:
+        case LED_BURST:
+            led_level(led, pattern.brightness);
+            first_ms = pattern.on_ms;
+            break;
+        case LED_PULSE:
+            led_level(led, 0);
+            first_ms = LED_PULSE_STEP_MS;
+            break;
+    }
+
+    if (first_ms > 0) {
+        led->alarm = add_alarm_in_ms(first_ms, led_alarm_callback, led, true);
+        if (led->alarm < 0) {
+            led->alarm = 0;
+            printf("LED: no alarm available\n");
+        }
+    }
+
+    restore_interrupts(irq_state);
+}
+
+void led_set(uint32_t gpio, bool on) {
+    led_set_pattern(gpio, on ? LED_PATTERN_ON : LED_PATTERN_OFF);
+}
+
+led_mode_t led_get_mode(uint32_t gpio) {
+    led_t *led = find_led(gpio);
+    return led != NULL ? led->pattern.mode : LED_OFF;
+}
+
+/**
+ hand the LED pins to PWM. LEFT and CENTER share a slice, so every slice gets the
+ same setup and the channels only differ in level
+ */
+void leds_init(void) {
+    pwm_config config = pwm_get_default_config();
+    pwm_config_set_wrap(&config, LED_PWM_WRAP);
+
+    for (uint i = 0; i < LED_COUNT; i++) {
+        gpio_set_function(leds[i].gpio, GPIO_FUNC_PWM);
+        pwm_set_gpio_level(leds[i].gpio, 0);
+        pwm_init(pwm_gpio_to_slice_num(leds[i].gpio), &config, true);
+        leds[i].pattern = LED_PATTERN_OFF;
+    }
+}
@@ -0,0 +1,38 @@
+// leds.h
+// LED patterns on the PWM slices. a pattern is set once and then runs from timer alarms,
+// nothing to call from the main loop
+
+#ifndef LEDS_H
+#define LEDS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    LED_OFF,
+    LED_ON,
+    LED_BLINK,      // on_ms on, off_ms off, forever
+    LED_PULSE,      // fade up over on_ms, down over off_ms, forever
+    LED_BURST       // count blinks of on_ms / off_ms, then off
+} led_mode_t;
+
+typedef struct {
+    led_mode_t mode;
+    uint16_t on_ms;
+    uint16_t off_ms;
+    uint16_t count;         // LED_BURST only
+    uint8_t brightness;     // 0-255, perceptual
+} led_pattern_t;
+
+#define LED_PATTERN_ON              ((led_pattern_t){ LED_ON, 0, 0, 0, 255 })
+#define LED_PATTERN_OFF             ((led_pattern_t){ LED_OFF, 0, 0, 0, 0 })
+#define LED_PATTERN_BLINK(on, off)  ((led_pattern_t){ LED_BLINK, (on), (off), 0, 255 })
+#define LED_PATTERN_PULSE(up, down) ((led_pattern_t){ LED_PULSE, (up), (down), 0, 255 })
+#define LED_PATTERN_BURST(n, on, off) ((led_pattern_t){ LED_BURST, (on), (off), (n), 255 })
+
+void leds_init(void);
+void led_set_pattern(uint32_t gpio, led_pattern_t pattern);
+void led_set(uint32_t gpio, bool on);
+led_mode_t led_get_mode(uint32_t gpio);
+
+#endif //LEDS_H
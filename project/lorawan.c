@@ -1,6 +1,9 @@
 
 #include "lorawan.h"
 #include "config.h"
+#include "uplink.h"
+#include "cpu_load.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,10 +11,71 @@
 #include <sys/unistd.h>
 
 #include "pico/stdlib.h"
+#include "pico/rand.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 
 // response buffer
 static char response_buffer[STRLEN] = {0};
 
+// rx ring, filled by the uart irq and drained by lorawan_poll_line()
+// single producer (irq) and single consumer (main loop), so no locks needed
+static volatile uint8_t rx_ring[LORAWAN_RX_RING_SIZE];
+static volatile uint32_t rx_ring_head = 0;   // written by the irq only
+static volatile uint32_t rx_ring_tail = 0;   // written by the consumer only
+static volatile uint32_t rx_overflows = 0;
+
+_Static_assert((LORAWAN_RX_RING_SIZE & (LORAWAN_RX_RING_SIZE - 1)) == 0, "rx ring size must be a power of two");
+
+// line being assembled, built incrementally as bytes come out of the ring
+static char rx_line[STRLEN];
+static int rx_pos = 0;
+
+/**
+ uart1 rx irq, moves everything in the hardware fifo into the ring
+ */
+static void on_lorawan_uart_rx(void) {
+    while (uart_is_readable(uart1)) {
+        uint8_t c = (uint8_t)uart_getc(uart1);
+        uint32_t head = rx_ring_head;
+
+        if (head - rx_ring_tail >= LORAWAN_RX_RING_SIZE) {
+            rx_overflows++; // consumer fell behind, drop the byte
+            continue;
+        }
+
+        rx_ring[head & (LORAWAN_RX_RING_SIZE - 1)] = c;
+        __dmb(); // byte lands before the head moves
+        rx_ring_head = head + 1;
+    }
+}
+
+/**
+ drain the rx ring into rx_line without waiting
+ returns true when rx_line holds a complete line, the next call starts a new one
+ */
+static bool lorawan_poll_line(void) {
+    while (rx_ring_tail != rx_ring_head) {
+        uint32_t tail = rx_ring_tail;
+        char c = (char)rx_ring[tail & (LORAWAN_RX_RING_SIZE - 1)];
+        rx_ring_tail = tail + 1;
+
+        if (rx_pos < STRLEN - 1) {
+            rx_line[rx_pos++] = c;
+            rx_line[rx_pos] = '\0';
+            if (c == '\n') {
+                rx_pos = 0;
+                return true;
+            }
+        } else {
+            // overlong line, drop it
+            rx_pos = 0;
+        }
+    }
+
+    return false;
+}
+
 // command validator
 typedef struct {
     const char* expected_outcome;
@@ -37,9 +101,11 @@ bool command_validator(const char* response, void* ctx) {
  utilizes lorawan_read_response to handle the response checking
  */
 bool lorawan_send_command(const char *command, char *where_to_store_response, const char *expected_outcome) {
+    TRACE_BEGIN(TRACE_LORA_SEND);
+
     // clear resp buffer before using
     if (where_to_store_response) {
-        memset(where_to_store_response, 0, STRLEN);
+        where_to_store_response[0] = '\0';
     }
 
     // EoL writing
@@ -54,10 +120,12 @@ bool lorawan_send_command(const char *command, char *where_to_store_response, co
     // validate
     if (!lorawan_read_response(LORAWAN_TIMEOUT_MS * 1000, command_validator, &cmd_ctx)) {
         printf("Command timed out: %s\n", command);
+        TRACE_END(TRACE_LORA_SEND);
         return false;
     }
 
     // timed out or match found
+    TRACE_END(TRACE_LORA_SEND);
     return cmd_ctx.found;
 }
 
@@ -66,210 +134,667 @@ bool lorawan_send_command(const char *command, char *where_to_store_response, co
  handles line by line reading from uart
  */
 bool lorawan_read_response(uint64_t timeout_us, bool (*validator)(const char*, void*), void* context) {
-    int pos = 0;
-    memset(response_buffer, 0, STRLEN); // clear resp buffer
+    TRACE_BEGIN(TRACE_LORA_READ);
+    rx_pos = 0; // start on a fresh line
 
     absolute_time_t timeout_time = make_timeout_time_us(timeout_us);
 
     while (!time_reached(timeout_time)) {
-        if (uart_is_readable(uart1)) {
-            char c = uart_getc(uart1);
-            if (pos < STRLEN - 1) {
-                response_buffer[pos++] = c;
-                response_buffer[pos] = '\0';
-
-                if (c == '\n') {
-                    // line done
-                    // printf("Response: %s", response_buffer);
-
-                    // make sure it's valid
-                    if (validator && validator(response_buffer, context)) {
-                        return true;
-                    }
-
-                    // clear buffer after line processing
-                    pos = 0;
-                    memset(response_buffer, 0, STRLEN);
-                }
-            } else {
-                // buffer overflow bs
-                pos = 0;
-                memset(response_buffer, 0, STRLEN);
+        if (lorawan_poll_line()) {
+            // line done
+            // printf("Response: %s", rx_line);
+
+            // make sure it's valid
+            if (validator && validator(rx_line, context)) {
+                memcpy(response_buffer, rx_line, strlen(rx_line) + 1); // keep the matching line
+                TRACE_END(TRACE_LORA_READ);
+                return true;
             }
+        } else {
+            // sleep until the rx irq (or the timeout) wakes us instead of spinning
+            best_effort_wfe_or_timeout(timeout_time);
         }
     }
 
     printf("Read timed out.\n");
+    TRACE_END(TRACE_LORA_READ);
     return false;
 }
 
-// join resp validator
+// core 0 -> core 1 event ring. core 0 is the only producer (lorawan_send_event), core 1
+// the only consumer (lorawan_poll), so it's lock-free like the rx ring
+static uplink_event_t ev_ring[LORAWAN_EVENT_RING_SIZE];
+static volatile uint32_t ev_ring_head = 0;   // written by core 0 only
+static volatile uint32_t ev_ring_tail = 0;   // written by core 1 only
+
+_Static_assert((LORAWAN_EVENT_RING_SIZE & (LORAWAN_EVENT_RING_SIZE - 1)) == 0, "event ring size must be a power of two");
+
+// per event status, event id = ring position + 1. whoever currently owns an event writes it
+static volatile int ev_status_id[LORAWAN_STATUS_HISTORY];
+static volatile uint8_t ev_status[LORAWAN_STATUS_HISTORY];
+
+// outbound frames, owned by core 1. ids keep counting up, slot = id % len
+// each frame collects events until it goes out
 typedef struct {
-    bool join_success;
-    bool join_failed;
-} JoinContext;
+    int first_event;    // id of events[0], the rest follow in order
+    uint8_t count;
+    uplink_event_t events[UPLINK_MAX_EVENTS];
+} QueuedMsg;
+
+static QueuedMsg tx_queue[LORAWAN_TX_QUEUE_LEN];
+static int tx_next_id = 1;      // id the next frame gets
+static int tx_head_id = 1;      // oldest frame not yet finished
+static bool tx_tail_open = false; // newest frame can still take events
+
+// every counter has exactly one writing core
+static lorawan_queue_stats_t queue_stats = {0};
+
+// uplink state machine, advanced by lorawan_poll()
+typedef enum {
+    TX_IDLE,
+    TX_WRITING,     // feeding the command into the uart fifo
+    TX_WAIT_ACK,    // waiting for the first +MSGHEX: line
+    TX_WAIT_DONE    // waiting for +MSGHEX: Done
+} TxState;
+
+static TxState tx_state = TX_IDLE;
+static char tx_command[sizeof("AT+MSGHEX=\"\"\r\n") + 2 * UPLINK_MAX_PAYLOAD];
+static size_t tx_command_len = 0;
+static size_t tx_command_pos = 0;
+static absolute_time_t tx_deadline;
+
+// link state machine, runs in lorawan_poll() until the modem has joined and again
+// whenever the link is lost. every step is one command written without blocking
+typedef enum {
+    LINK_BACKOFF,   // waiting for link_retry_at, the first try is due right away
+    LINK_PROBE,     // AT, is the modem there at all
+    LINK_CONFIG,    // MODE, KEY, CLASS, PORT one after the other
+    LINK_JOIN,      // AT+JOIN until +JOIN: Done or Joined already
+    LINK_UP
+} LinkState;
+
+static const struct {
+    const char *command;
+    const char *outcome;
+} link_config[] = {
+    { LORAWAN_MODE, LORAWAN_MODE_OUTCOME },
+    { LORAWAN_KEY, LORAWAN_KEY_OUTCOME },
+    { LORAWAN_CLASS, LORAWAN_CLASS_OUTCOME },
+    { LORAWAN_PORT, LORAWAN_PORT_OUTCOME },
+};
+
+#define LINK_CONFIG_STEPS ((int)(sizeof(link_config) / sizeof(link_config[0])))
+
+static LinkState link_state = LINK_BACKOFF;
+static absolute_time_t link_retry_at;       // zero, so the first try starts at once
+static absolute_time_t link_deadline;       // for the reply to the command in flight
+static uint32_t link_timeout_ms;
+static uint32_t link_failed_tries = 0;      // since the link was last up, sets the backoff
+static int link_config_step;
+static bool link_config_skipped;            // this try trusted the cached session
+static bool link_join_ok;                   // +JOIN: Network joined seen
+static int link_failed_uplinks = 0;         // in a row
+static lorawan_link_stats_t link_stats = {0};
+
+// span of the link step or uplink phase in flight, TRACE_SPAN_COUNT for none
+static trace_span_t lora_span = TRACE_SPAN_COUNT;
+
+// session cache, written by core 1 and saved with the state record by core 0
+static volatile uint8_t session_state = LORAWAN_SESSION_NONE;
+static volatile uint32_t session_changes = 0;
+
+static void link_lost(const char *why);
+
 /**
- a validator specifically for join responses, idk why they decided it has so many ***** responses
- checks  for response and updates the join context accordingly
+ close the span in flight and open the next one, the state machines only ever have one
  */
-bool join_validator(const char* response, void* ctx) {
-    JoinContext* join_ctx = ctx;
+static void lora_trace(trace_span_t span) {
+    if (lora_span != TRACE_SPAN_COUNT) {
+        TRACE_END(lora_span);
+    }
+    if (span != TRACE_SPAN_COUNT) {
+        TRACE_BEGIN(span);
+    }
+    lora_span = span;
+}
 
-    if (strstr(response, "+JOIN: Join failed")) {
-        printf("Join failed!\n");
-        join_ctx->join_failed = true;
-        return true; // end  with failure
-    } else if (strstr(response, "+JOIN: LoRaWAN modem is busy")) {
-        printf("Join ongoing...\n");
-    } else if (strstr(response, "+JOIN: Done")) {
-        printf("Join successful!\n");
-        join_ctx->join_success = true;
-        return true; // end with success
+static QueuedMsg *tx_slot(int id) {
+    return &tx_queue[id % LORAWAN_TX_QUEUE_LEN];
+}
+
+static void set_event_status(int id, lorawan_msg_status_t status) {
+    int idx = id % LORAWAN_STATUS_HISTORY;
+    ev_status[idx] = (uint8_t)status;
+    ev_status_id[idx] = id;
+}
+
+static void set_frame_status(const QueuedMsg *msg, lorawan_msg_status_t status) {
+    for (int i = 0; i < msg->count; i++) {
+        set_event_status(msg->first_event + i, status);
     }
+}
 
-    return false; // continue
+/**
+ encode a frame and wrap it in AT+MSGHEX, returns the command length
+ */
+static size_t build_msghex_command(const QueuedMsg *msg, uint32_t now_ms) {
+    static const char hex[] = "0123456789ABCDEF";
+    uint8_t payload[UPLINK_MAX_PAYLOAD];
+    size_t len = uplink_encode(msg->events, msg->count, now_ms, payload, sizeof(payload));
+
+    size_t pos = (size_t)snprintf(tx_command, sizeof(tx_command), "AT+MSGHEX=\"");
+    for (size_t i = 0; i < len; i++) {
+        tx_command[pos++] = hex[payload[i] >> 4];
+        tx_command[pos++] = hex[payload[i] & 0x0F];
+    }
+    memcpy(tx_command + pos, "\"\r\n", 3);
+
+    return pos + 3;
 }
 
 /**
- tries to join the school lorawan network
- first sends all the necessary commands, then the +join command that has a stupid amount of responses
- so we have to make these funcs to handle it properly
+ put an event into a frame, packing it into the newest one if that hasn't gone out yet
+ core 1 only
+ */
+static void frame_add_event(const uplink_event_t *ev, int id) {
+    if (tx_tail_open) {
+        QueuedMsg *tail = tx_slot(tx_next_id - 1);
+        if (tail->count < UPLINK_MAX_EVENTS) {
+            tail->events[tail->count++] = *ev;
+            return;
+        }
+    }
+
+    int waiting = tx_next_id - tx_head_id;
+    if (waiting >= LORAWAN_TX_QUEUE_LEN) {
+        printf("LoRaWAN queue full, dropping event: %s\n", uplink_event_name(ev->code));
+        queue_stats.dropped++;
+        set_event_status(id, LORAWAN_MSG_FAILED);
+        return;
+    }
+
+    QueuedMsg *msg = tx_slot(tx_next_id);
+    msg->first_event = id;
+    msg->count = 1;
+    msg->events[0] = *ev;
+    tx_next_id++;
+    tx_tail_open = true;
+
+    if ((uint32_t)(waiting + 1) > queue_stats.high_water) {
+        queue_stats.high_water = waiting + 1;
+    }
+}
+
+static void tx_finish(lorawan_msg_status_t status) {
+    QueuedMsg *msg = tx_slot(tx_head_id);
+    set_frame_status(msg, status);
+
+    if (status == LORAWAN_MSG_SENT) {
+        printf("Success: Message Sent\n");
+        queue_stats.sent++;
+        link_failed_uplinks = 0;
+    } else {
+        printf("Message Sending Failed (%d events)\n", msg->count);
+        queue_stats.failed++;
+        link_failed_uplinks++;
+    }
+
+    tx_head_id++;
+    tx_state = TX_IDLE;
+    lora_trace(TRACE_SPAN_COUNT);
 
+    if (link_failed_uplinks >= LORAWAN_LINK_FAIL_LIMIT) {
+        link_lost("uplinks keep failing");
+    }
+}
+
+/**
+ FNV-1a over the configuration commands, a cached session is only good for the same ones
  */
-bool try_join() {
-    // initial network commands
-    if (!lorawan_send_command(LORAWAN_MODE, response_buffer, LORAWAN_MODE_OUTCOME)) {
-        printf("LoRa Mode command failed\n");
-        return false;
+static uint32_t config_hash(void) {
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < LINK_CONFIG_STEPS; i++) {
+        for (const char *c = link_config[i].command; *c != '\0'; c++) {
+            hash = (hash ^ (uint8_t)*c) * 16777619u;
+        }
     }
-    if (!lorawan_send_command(LORAWAN_KEY, response_buffer, LORAWAN_KEY_OUTCOME)) {
-        printf("LoRa appkey command failed\n");
-        return false;
+    return hash;
+}
+
+static void set_session(lorawan_session_state_t new_state) {
+    if (session_state != new_state) {
+        session_state = (uint8_t)new_state;
+        session_changes++;
     }
-    if (!lorawan_send_command(LORAWAN_CLASS, response_buffer, LORAWAN_CLASS_OUTCOME)) {
-        printf("LoRa class command failed\n");
-        return false;
+}
+
+/**
+ start writing a command, link_poll() feeds it into the uart and starts the timeout
+ */
+static void link_command(LinkState next, const char *command, uint32_t timeout_ms) {
+    size_t len = strlen(command);
+
+    memcpy(tx_command, command, len);
+    memcpy(tx_command + len, "\r\n", 2);
+    tx_command_len = len + 2;
+    tx_command_pos = 0;
+    link_timeout_ms = timeout_ms;
+    link_state = next;
+    lora_trace(next == LINK_PROBE ? TRACE_LORA_PROBE : next == LINK_CONFIG ? TRACE_LORA_CONFIG : TRACE_LORA_JOIN);
+}
+
+/**
+ jittered exponential backoff, somewhere between half and all of base * 2^tries, capped.
+ devices that lost the gateway at the same time don't all come back at the same time
+ */
+static uint32_t backoff_ms(uint32_t tries) {
+    uint32_t delay = LORAWAN_BACKOFF_MAX_MS;
+
+    if (tries < 16 && ((uint32_t)LORAWAN_BACKOFF_BASE_MS << tries) < LORAWAN_BACKOFF_MAX_MS) {
+        delay = (uint32_t)LORAWAN_BACKOFF_BASE_MS << tries;
     }
-    if (!lorawan_send_command(LORAWAN_PORT, response_buffer, LORAWAN_PORT_OUTCOME)) {
-        printf("LoRa port command failed\n");
-        return false;
+    return delay / 2 + get_rand_32() % (delay / 2 + 1);
+}
+
+static void link_retry(uint32_t delay_ms) {
+    tx_command_len = tx_command_pos = 0;
+    link_retry_at = make_timeout_time_ms(delay_ms);
+    link_state = LINK_BACKOFF;
+    lora_trace(TRACE_SPAN_COUNT);
+}
+
+static void link_fail(const char *why) {
+    // the configuration is in doubt after a failed config step, or a join that trusted the cache
+    if (link_state == LINK_CONFIG || (link_state == LINK_JOIN && link_config_skipped)) {
+        set_session(LORAWAN_SESSION_NONE);
     }
 
-    printf("Sending JOIN command...\n");
-    uart_write_blocking(uart1, (const uint8_t*)LORAWAN_JOIN, strlen(LORAWAN_JOIN));
-    uart_write_blocking(uart1, (const uint8_t*)"\r\n", 2);
+    uint32_t delay = backoff_ms(link_failed_tries++);
+    link_stats.failures++;
+    printf("LoRaWAN %s, trying again in %u ms\n", why, delay);
+    link_retry(delay);
+}
 
-    // join context initialization, hacky way of making sure responses are valid but meh
-    JoinContext join_ctx = { false, false };
+static void link_up(void) {
+    link_state = LINK_UP;
+    lora_trace(TRACE_SPAN_COUNT);
+    link_failed_tries = 0;
+    link_failed_uplinks = 0;
+    link_stats.joins++;
+    link_stats.up_ms = to_ms_since_boot(get_absolute_time());
+    set_session(LORAWAN_SESSION_JOINED);
+    lorawan_connected = true;
+    printf("LoRaWAN joined %u ms after boot%s\n", link_stats.up_ms,
+           link_config_skipped ? ", modem configuration cached" : "");
+}
 
-    // read join responses and validate them with a 20 sec timeout
-    lorawan_read_response(20 * 1000000, join_validator, &join_ctx);
+/**
+ the modem lost the session or stopped answering, join again straight away
+ */
+static void link_lost(const char *why) {
+    printf("LoRaWAN link lost (%s)\n", why);
+    lorawan_connected = false;
+    link_stats.losses++;
+    if (session_state == LORAWAN_SESSION_JOINED) {
+        set_session(LORAWAN_SESSION_CONFIGURED);
+    }
+    link_retry(0);
+}
+
+/**
+ one reply line for the step in flight, returns true when it moved the link on
+ */
+static bool link_line(const char *line) {
+    switch (link_state) {
+        case LINK_PROBE:
+            if (strstr(line, LORA_TEST_OUTCOME) == NULL) {
+                return false;
+            }
+            link_config_skipped = session_state != LORAWAN_SESSION_NONE;
+            if (link_config_skipped) {
+                link_stats.config_skipped++;
+                link_join_ok = false;
+                link_command(LINK_JOIN, LORAWAN_JOIN, LORAWAN_JOIN_TIMEOUT_MS);
+            } else {
+                link_config_step = 0;
+                link_command(LINK_CONFIG, link_config[0].command, LORAWAN_TIMEOUT_MS);
+            }
+            return true;
+
+        case LINK_CONFIG:
+            if (strstr(line, "LoRaWAN modem is busy") != NULL) {
+                link_fail("modem busy");
+                return true;
+            }
+            if (strstr(line, link_config[link_config_step].outcome) == NULL) {
+                return false;
+            }
+            if (++link_config_step < LINK_CONFIG_STEPS) {
+                link_command(LINK_CONFIG, link_config[link_config_step].command, LORAWAN_TIMEOUT_MS);
+            } else {
+                set_session(LORAWAN_SESSION_CONFIGURED);
+                link_join_ok = false;
+                link_command(LINK_JOIN, LORAWAN_JOIN, LORAWAN_JOIN_TIMEOUT_MS);
+            }
+            return true;
 
-    return join_ctx.join_success && !join_ctx.join_failed;
+        case LINK_JOIN:
+            // busy lines fall through: a join still running from before a reboot answers
+            // busy and its Done comes all the same
+            if (strstr(line, "+JOIN: Joined already") != NULL) {
+                link_up();
+                return true;
+            }
+            if (strstr(line, "+JOIN: Network joined") != NULL) {
+                link_join_ok = true;
+            } else if (strstr(line, "+JOIN: Done") != NULL) {
+                if (link_join_ok) {
+                    link_up();
+                } else {
+                    link_fail("join failed");
+                }
+                return true;
+            }
+            return false;
+
+        default:
+            return false;
+    }
 }
 
-// message response validator
-typedef struct {
-    bool msg_done;
-} MsgContext;
+/**
+ bring the link up without blocking, returns true while a step is in flight
+ */
+static bool link_poll(void) {
+    if (link_state == LINK_BACKOFF) {
+        if (!time_reached(link_retry_at)) {
+            return false;
+        }
+        link_stats.attempts++;
+        rx_pos = 0;
+        link_command(LINK_PROBE, LORA_TEST, LORAWAN_TIMEOUT_MS);
+    }
+
+    // the reply timeout starts once the whole command is out
+    if (tx_command_pos < tx_command_len) {
+        while (tx_command_pos < tx_command_len && uart_is_writable(uart1)) {
+            uart_putc_raw(uart1, tx_command[tx_command_pos++]);
+        }
+        if (tx_command_pos < tx_command_len) {
+            return true;
+        }
+        link_deadline = make_timeout_time_ms(link_timeout_ms);
+    }
+
+    while (lorawan_poll_line()) {
+        if (link_line(rx_line)) {
+            return link_state != LINK_BACKOFF; // the next step starts on the next poll
+        }
+    }
+
+    if (time_reached(link_deadline)) {
+        link_fail(link_state == LINK_PROBE ? "modem not answering" :
+                  link_state == LINK_CONFIG ? "config command timed out" : "join timed out");
+        return false;
+    }
+    return true;
+}
 
 /**
- validate message responses from lorawan
- mainly for the send_text function, the end result of it is +MSG: Done so we're only care about that
+ advance the uplink state machine, never blocks
+ runs on core 1, returns true if there's still something in flight
  */
-bool msg_validator(const char* response, void* ctx) {
-    MsgContext* msg_ctx = (MsgContext*)ctx;
+bool lorawan_poll(void) {
+    // move new events from core 0 into frames
+    while (ev_ring_tail != ev_ring_head) {
+        uint32_t tail = ev_ring_tail;
+        __dmb(); // see the event core 0 wrote before it moved head
+        uplink_event_t ev = ev_ring[tail & (LORAWAN_EVENT_RING_SIZE - 1)];
+        ev_ring_tail = tail + 1;
+        frame_add_event(&ev, (int)tail + 1);
+    }
 
-    if (strstr(response, "+MSG: Done") != NULL) {
-        printf("Success: Message Sent\n");
-        msg_ctx->msg_done = true;
-        return true; // End processing with success
+    // frames wait in the queue until the link is up
+    if (link_state != LINK_UP) {
+        return link_poll();
     }
 
-    return false; // Continue processing
+    switch (tx_state) {
+        case TX_IDLE:
+            if (tx_head_id == tx_next_id) {
+                return false; // nothing queued
+            }
+            QueuedMsg *msg = tx_slot(tx_head_id);
+            uint32_t now = to_ms_since_boot(get_absolute_time());
+
+            // hold a lone, part-filled frame for a moment so events close together share it
+            bool more_behind = tx_next_id - tx_head_id > 1;
+            if (!more_behind && msg->count < UPLINK_MAX_EVENTS &&
+                now - msg->events[0].timestamp_ms < LORAWAN_EVENT_COALESCE_MS) {
+                return true;
+            }
+
+            if (!more_behind) {
+                tx_tail_open = false; // it's going out, later events start a new frame
+            }
+            set_frame_status(msg, LORAWAN_MSG_SENDING);
+            tx_command_len = build_msghex_command(msg, now);
+            tx_command_pos = 0;
+            rx_pos = 0;
+            tx_state = TX_WRITING;
+            lora_trace(TRACE_LORA_TX_WRITE);
+            // fall through and start writing right away
+
+        case TX_WRITING:
+            while (tx_command_pos < tx_command_len && uart_is_writable(uart1)) {
+                uart_putc_raw(uart1, tx_command[tx_command_pos++]);
+            }
+            if (tx_command_pos == tx_command_len) {
+                tx_deadline = make_timeout_time_ms(LORAWAN_TIMEOUT_MS);
+                tx_state = TX_WAIT_ACK;
+                lora_trace(TRACE_LORA_TX_ACK);
+            }
+            break;
+
+        case TX_WAIT_ACK:
+        case TX_WAIT_DONE:
+            // AT+MSGHEX answers with +MSGHEX: lines, the text AT+MSG with +MSG:, take either
+            while (lorawan_poll_line()) {
+                if (strstr(rx_line, "Please join network first") != NULL) {
+                    // the modem lost the session, the frame goes again once we've joined
+                    set_frame_status(tx_slot(tx_head_id), LORAWAN_MSG_QUEUED);
+                    tx_state = TX_IDLE;
+                    link_lost("not joined");
+                    return true;
+                }
+                bool msg_line = strstr(rx_line, "+MSG:") != NULL || strstr(rx_line, "+MSGHEX:") != NULL;
+                if (msg_line && strstr(rx_line, ": Done") != NULL) {
+                    tx_finish(LORAWAN_MSG_SENT);
+                    return true;
+                }
+                if (tx_state == TX_WAIT_ACK && msg_line) {
+                    // modem took it, now wait for the uplink to finish
+                    tx_deadline = make_timeout_time_ms(LORAWAN_MSG_DONE_TIMEOUT_MS);
+                    tx_state = TX_WAIT_DONE;
+                    lora_trace(TRACE_LORA_TX_DONE);
+                }
+            }
+            if (time_reached(tx_deadline)) {
+                tx_finish(LORAWAN_MSG_FAILED);
+            }
+            break;
+    }
+
+    return true;
+}
+
+static uplink_event_t make_event(uplink_event_code_t code, int pill) {
+    uplink_event_t ev = {
+        .code = (uint8_t)code,
+        .flags = (calibrated ? UPLINK_FLAG_CALIBRATED : 0) |
+                 (dispensing_in_progress ? UPLINK_FLAG_DISPENSING : 0) |
+                 (eeprom_initialized ? UPLINK_FLAG_EEPROM_OK : 0),
+        .pill = (pill >= 0 && pill < UPLINK_NO_PILL) ? (uint8_t)pill : UPLINK_NO_PILL,
+        .timestamp_ms = to_ms_since_boot(get_absolute_time())
+    };
+    return ev;
 }
-/***
- send text to lorawan network
- makes sure that the given text is not null, and modifies it to be in the proper format
- waits for response and validates it using msg_validator function
 
+/***
+ queue an event for the lorawan network and return straight away
+ core 0 only. core 1 packs it into a frame and sends it in the background, while the
+ link is down (still joining at boot, or lost) the frames wait for it
+ returns the event id for lorawan_message_status(), or -1 if nothing was queued
  */
-void lorawan_send_text(bool connected, const char* text) {
-    // make sure lorawan is connected
-    if (!connected) {
-        printf("LoRaWAN is not connected. Skipping message send.\n");
-        return;
+int lorawan_send_event(uplink_event_code_t code, int pill) {
+    if (!lorawan_connected) {
+        queue_stats.while_down++;
     }
 
-    // make sure given text isn't null or empty
-    if (!text || text[0] == '\0') {
-        printf("Error: Cannot send empty message\n");
-        return;
+    uint32_t head = ev_ring_head;
+    if (head - ev_ring_tail >= LORAWAN_EVENT_RING_SIZE) {
+        printf("LoRaWAN event ring full, dropping event: %s\n", uplink_event_name(code));
+        queue_stats.ring_dropped++;
+        return -1;
     }
 
-    // bufrfer size calculation
-    size_t text_len = strlen(text);
-    size_t cmd_size = text_len + 12; // "AT+MSG=\"\"!" + null terminator
+    int id = (int)head + 1;
+    ev_ring[head & (LORAWAN_EVENT_RING_SIZE - 1)] = make_event(code, pill);
+    set_event_status(id, LORAWAN_MSG_QUEUED);
+    queue_stats.queued++;
 
-    char command[cmd_size];
-    snprintf(command, cmd_size, "AT+MSG=\"%s!\"", text); // combine given text into the right format
+    __dmb(); // event is visible before core 1 sees the new head
+    ev_ring_head = head + 1;
+    __sev(); // wake core 1 if it's waiting
 
-    // send command and handle the results
-    if (lorawan_send_command(command, response_buffer, "+MSG:")) {
-        // Create message context and initialize it
-        MsgContext msg_ctx = { false };
+    return id;
+}
 
-        // Read and process MSG responses with a 10-second timeout
-        lorawan_read_response(10 * 1000000, msg_validator, &msg_ctx);
+lorawan_msg_status_t lorawan_message_status(int id) {
+    if (id <= 0) {
+        return LORAWAN_MSG_UNKNOWN;
+    }
 
-        if (!msg_ctx.msg_done) {
-            printf("Message send did not complete\n");
-        }
-    } else {
-        // we didn't get a msg + done so we failed for reasons xyz
-        printf("Message Sending Failed\n");
+    int idx = id % LORAWAN_STATUS_HISTORY;
+    return ev_status_id[idx] == id ? (lorawan_msg_status_t)ev_status[idx] : LORAWAN_MSG_UNKNOWN;
+}
+
+lorawan_queue_stats_t lorawan_get_queue_stats(void) {
+    queue_stats.rx_overflows = rx_overflows;
+    return queue_stats;
+}
+
+/**
+ how long core 1 may sleep after lorawan_poll(). a reply byte or core 0's __sev() for a
+ new event wakes it earlier
+ */
+static absolute_time_t poll_wake_time(void) {
+    if (ev_ring_tail != ev_ring_head) {
+        return get_absolute_time(); // events from core 0 still to put into frames
+    }
+    if (tx_command_pos < tx_command_len) {
+        return make_timeout_time_ms(1); // the fifo holds 32 bytes, 33 ms at 9600 baud, don't spin on it
     }
+
+    switch (link_state) {
+        case LINK_BACKOFF:
+            return link_retry_at;
+        case LINK_UP:
+            break;
+        default:
+            return link_deadline;
+    }
+
+    if (tx_state == TX_WAIT_ACK || tx_state == TX_WAIT_DONE) {
+        return tx_deadline;
+    }
+    if (tx_head_id != tx_next_id) {
+        // a lone frame held back so events close together share it, until its window closes
+        uint32_t send_ms = tx_slot(tx_head_id)->events[0].timestamp_ms + LORAWAN_EVENT_COALESCE_MS;
+        return from_us_since_boot((uint64_t)send_ms * 1000);
+    }
+    return make_timeout_time_ms(LORAWAN_CORE1_IDLE_MS);
 }
 
 /**
- initialize lorawan module
+ one turn of core 1's loop: sleep until something can happen, then advance everything
  */
-void init_lorawan() {
-    uart_init(uart1, LORAWAN_BAUD_RATE);
+void lorawan_core1_step(void) {
+    cpu_load_idle_begin();
+    best_effort_wfe_or_timeout(poll_wake_time());
+    cpu_load_idle_end();
+    cpu_load_count_wakeup();
 
-    gpio_set_function(UART_TX, GPIO_FUNC_UART);
-    gpio_set_function(UART_RX, GPIO_FUNC_UART);
-    printf("LoraWAN initialized...\n");
+    lorawan_poll();
 }
 
 /**
- tries to join lorawan network LORAWAN_MAX_TRIES amount of times
- sends a test message before attempting join
- if successfull, proceeds to try_join()
- why we've split these into 2 functions? good question, i forgot why i did that last week
- but we're sticking with it anyway
+ core 1 entry point, all modem I/O happens here
+ joins in the background, keeps the uplink state machine going and sleeps when there's nothing to do
  */
-bool lorawan_try_connect() {
-    printf("Trying to connect to LoRaWAN module...\n");
+void lorawan_core1_main(void) {
+    init_lorawan();
 
-    for (int i = 0; i < LORAWAN_MAX_TRIES; i++) {
-        printf("Connection attempt %d of %d...\n", i + 1, LORAWAN_MAX_TRIES);
+    // goes out as soon as the link is up
+    uplink_event_t ev = make_event(UPLINK_EV_BOOT, -1);
+    frame_add_event(&ev, 0);
 
-        if (lorawan_send_command(LORA_TEST, response_buffer, LORA_TEST_OUTCOME)) {
-            printf("Successfully connected to LoRaWAN module, trying to join network...\n");
+    while (true) {
+        lorawan_core1_step();
+    }
+}
 
-            // try join once per attempt
-            if (try_join()) {
-                printf("Connected to network\n");
-                return true;
-            } else {
-                printf("Failed to join network, will retry connection sequence...\n");
-            }
-        } else {
-            printf("No response from LoRaWAN module on attempt %d\n", i + 1);
-        }
+/**
+ take the session the last boot saved, core 0 before core 1 starts
+ a session for different configuration commands is no good
+ */
+void lorawan_restore_session(lorawan_session_t session) {
+    if (session.state != LORAWAN_SESSION_NONE && session.state <= LORAWAN_SESSION_JOINED &&
+        session.config_hash == config_hash()) {
+        session_state = session.state;
+        printf("LoRaWAN session cached: %s\n", session.state == LORAWAN_SESSION_JOINED ? "joined" : "configured");
     }
+}
 
-    printf("Failed to establish connection after %d attempts\n", LORAWAN_MAX_TRIES);
-    return false;
-}
\ No newline at end of file
+lorawan_session_t lorawan_get_session(void) {
+    lorawan_session_t session = { session_state, config_hash() };
+    return session;
+}
+
+uint32_t lorawan_session_changes(void) {
+    return session_changes;
+}
+
+/**
+ drop the link and bring it up again, core 1 only. without the session it starts from
+ configuring the modem
+ */
+void lorawan_link_restart(bool keep_session) {
+    lorawan_connected = false;
+    if (!keep_session) {
+        set_session(LORAWAN_SESSION_NONE);
+    }
+    link_failed_tries = 0;
+    link_retry(0);
+}
+
+lorawan_link_stats_t lorawan_get_link_stats(void) {
+    return link_stats;
+}
+
+/**
+ initialize lorawan module
+ */
+void init_lorawan() {
+    uart_init(uart1, LORAWAN_BAUD_RATE);
+
+    gpio_set_function(UART_TX, GPIO_FUNC_UART);
+    gpio_set_function(UART_RX, GPIO_FUNC_UART);
+
+    // rx goes through the irq into the ring, nothing gets lost while we're busy elsewhere
+    irq_set_exclusive_handler(UART1_IRQ, on_lorawan_uart_rx);
+    irq_set_enabled(UART1_IRQ, true);
+    uart_set_irq_enables(uart1, true, false);
+    printf("LoraWAN initialized...\n");
+}
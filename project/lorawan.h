@@ -4,19 +4,77 @@
 
 #include <stdbool.h>
 #include "hardware/uart.h"
+#include "uplink.h"
 
 void init_lorawan(void);
 
-bool lorawan_try_connect(void);
-
 bool lorawan_send_command(const char *command, char *where_to_store_response, const char *expected_outcome);
 
 typedef bool (*ResponseValidator)(const char* response, void* context);
 
 bool lorawan_read_response(uint64_t timeout_us, ResponseValidator validator, void* context);
 
-bool try_join(void);
+// outbound message state
+typedef enum {
+    LORAWAN_MSG_UNKNOWN,    // id never issued or slot already reused
+    LORAWAN_MSG_QUEUED,
+    LORAWAN_MSG_SENDING,
+    LORAWAN_MSG_SENT,
+    LORAWAN_MSG_FAILED,
+} lorawan_msg_status_t;
+
+typedef struct {
+    uint32_t queued;        // events, several can share one frame
+    uint32_t sent;          // frames
+    uint32_t failed;        // frames
+    uint32_t dropped;       // events lost because the frame queue was full
+    uint32_t ring_dropped;  // events lost because core 1 fell behind
+    uint32_t while_down;    // events queued while the link wasn't up
+    uint32_t high_water;    // most messages waiting at once
+    uint32_t rx_overflows;  // modem bytes lost because the rx ring was full
+} lorawan_queue_stats_t;
+
+// what a warm boot can skip, cached in the EEPROM state record
+typedef enum {
+    LORAWAN_SESSION_NONE,       // configure the modem from scratch
+    LORAWAN_SESSION_CONFIGURED, // the modem has our MODE, KEY, CLASS and PORT
+    LORAWAN_SESSION_JOINED,     // and was joined, AT+JOIN should answer Joined already
+} lorawan_session_state_t;
+
+typedef struct {
+    uint8_t state;
+    uint32_t config_hash;   // of the configuration commands, a new key invalidates the cache
+} lorawan_session_t;
+
+typedef struct {
+    uint32_t attempts;      // tries to bring the link up
+    uint32_t failures;
+    uint32_t joins;         // times it came up
+    uint32_t losses;        // times it went down again
+    uint32_t config_skipped; // tries that trusted the cached session
+    uint32_t up_ms;         // since boot, when it last came up
+} lorawan_link_stats_t;
+
+int lorawan_send_event(uplink_event_code_t code, int pill);
+
+bool lorawan_poll(void);
+
+void lorawan_core1_main(void);
+
+void lorawan_core1_step(void);
+
+// status of an event by the id lorawan_send_event() returned
+lorawan_msg_status_t lorawan_message_status(int id);
+
+lorawan_queue_stats_t lorawan_get_queue_stats(void);
+
+// session cache, restore before core 1 starts. the change count tells core 0 when to save
+void lorawan_restore_session(lorawan_session_t session);
+lorawan_session_t lorawan_get_session(void);
+uint32_t lorawan_session_changes(void);
 
-void lorawan_send_text(bool connected, const char* text);
+// core 1 only
+void lorawan_link_restart(bool keep_session);
+lorawan_link_stats_t lorawan_get_link_stats(void);
 
 #endif //LORA_TEST_H
\ No newline at end of file
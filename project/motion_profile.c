@@ -0,0 +1,75 @@
+// motion_profile.c
+
+#include <math.h>
+#include <stdio.h>
+#include "config.h"
+#include "motion_profile.h"
+
+static motion_params_t params = { MOTION_START_SPS, MOTION_MAX_SPS, MOTION_ACCEL_SPS2 };
+
+// ramp_table[i] = interval before step i+1 while accelerating, ramp_len entries used
+static uint16_t ramp_table[MOTION_RAMP_MAX];
+static int ramp_len = 0;
+static bool table_ready = false;
+
+/**
+ v_i = sqrt(v0^2 + 2*a*i), one interval per step until we hit max speed
+ */
+static void build_ramp_table(void) {
+    float v0 = params.start_sps;
+    float a = params.accel_sps2;
+
+    ramp_len = 0;
+    while (ramp_len < MOTION_RAMP_MAX) {
+        float v = sqrtf(v0 * v0 + 2.0f * a * (float)ramp_len);
+        if (v >= params.max_sps) break;
+        ramp_table[ramp_len++] = (uint16_t)(1000000.0f / v);
+    }
+
+    table_ready = true;
+}
+
+/**
+ set new limits, rejects anything the motor obviously can't do
+ */
+bool motion_set_params(motion_params_t p) {
+    if (p.start_sps < MOTION_MIN_SPS || p.max_sps < p.start_sps || p.accel_sps2 == 0) {
+        printf("Invalid motion parameters: start %u, max %u, accel %u\n", p.start_sps, p.max_sps, p.accel_sps2);
+        return false;
+    }
+
+    params = p;
+    build_ramp_table();
+    return true;
+}
+
+motion_params_t motion_get_params(void) {
+    return params;
+}
+
+motion_plan_t motion_plan(int steps) {
+    if (!table_ready) {
+        build_ramp_table();
+    }
+
+    // where on the ramp a step is comes from its distance to the ends of the move, see
+    // motion_step_interval_us()
+    motion_plan_t plan = { steps };
+    return plan;
+}
+
+/**
+ interval to wait after the given step (0 based) of the plan
+ */
+uint32_t motion_step_interval_us(const motion_plan_t *plan, int step) {
+    // distance from the nearer end of the move decides where on the ramp we are, so
+    // short moves turn around mid ramp and a single step goes at the start speed
+    int from_end = plan->steps - 1 - step;
+    int k = step < from_end ? step : from_end;
+
+    if (k < ramp_len) {
+        return ramp_table[k];
+    }
+
+    return 1000000u / params.max_sps;
+}
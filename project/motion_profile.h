@@ -0,0 +1,27 @@
+// motion_profile.h
+// trapezoidal step timing: ramp up from the start speed, cruise, ramp down
+// the ramp is precomputed into a table of step intervals whenever the parameters change
+
+#ifndef MOTION_PROFILE_H
+#define MOTION_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint16_t start_sps;     // speed the motor can start/stop at without a ramp, steps/s
+    uint16_t max_sps;       // cruise speed, steps/s
+    uint16_t accel_sps2;    // steps/s^2
+} motion_params_t;
+
+// one planned move
+typedef struct {
+    int steps;
+} motion_plan_t;
+
+bool motion_set_params(motion_params_t params);
+motion_params_t motion_get_params(void);
+motion_plan_t motion_plan(int steps);
+uint32_t motion_step_interval_us(const motion_plan_t *plan, int step);
+
+#endif //MOTION_PROFILE_H
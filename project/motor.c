@@ -3,13 +3,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <pico/util/queue.h>
 #include "pico/stdlib.h"
+#include "hardware/sync.h"
 #include "hardware/i2c.h"
 #include "pico/time.h"
 #include "lorawan.h"
 #include "eeprom.h"
 #include "config.h"
+#include "cpu_load.h"
+#include "motion_profile.h"
+#include "events.h"
+#include "trace.h"
 
 
 extern i2c_inst_t *eeprom_i2c;
@@ -20,108 +24,517 @@ const uint8_t half_step[8][4] = {
     {0,0,1,0}, {0,0,1,1}, {0,0,0,1}, {1,0,0,1}
 };
 
-// clear queue
-void flush_events() {
-    event_t junk;
-    while (queue_try_remove(&events, &junk)) {}
+// the same table as GPIO masks so all four coils change in one SIO write, no glitching
+// through invalid in-between states. a PIO sequencer could do this too (out pins over
+// 2..13 only reaches the pins handed to PIO), but every step also moves the position,
+// the backlash count and the dispense mark, and the ramp changes the interval step by
+// step. so the CPU takes a timer irq per step and keeps that bookkeeping where it is
+#define MOTOR_PIN_MASK ((1u << IN1) | (1u << IN2) | (1u << IN3) | (1u << IN4))
+#define HALF_STEP_MASK(a, b, c, d) (((a) << IN1) | ((b) << IN2) | ((c) << IN3) | ((d) << IN4))
+
+static const uint32_t half_step_mask[8] = {
+    HALF_STEP_MASK(1,0,0,0), HALF_STEP_MASK(1,1,0,0), HALF_STEP_MASK(0,1,0,0), HALF_STEP_MASK(0,1,1,0),
+    HALF_STEP_MASK(0,0,1,0), HALF_STEP_MASK(0,0,1,1), HALF_STEP_MASK(0,0,0,1), HALF_STEP_MASK(1,0,0,1)
+};
+
+static uint32_t achieved_rate_x10 = 0; // steps per second * 10 over the last move
+
+// motion engine, steps are driven from a hardware alarm so moves don't hold up the caller
+static volatile bool motion_active = false;
+static volatile int32_t motion_pos = 0;     // steps from the aligned home position
+static volatile int32_t motion_target_pos = 0; // where the current move ends
+static bool position_valid = false;         // motion_pos is known, no re-home needed
+static motion_plan_t active_plan;
+static volatile int active_index = 0;       // next step of the plan to take
+static bool active_notify = false;
+static alarm_id_t motion_alarm = 0;
+static uint64_t motion_start_us = 0;
+static int motion_dir = 1;                  // 1 forwards, -1 backwards
+static int last_dir = 1;                    // way the gear train was last driven
+static volatile int backlash_left = 0;      // slack steps still to take up, the output doesn't move
+static int mark_index = -1;                 // step of the move to timestamp, -1 for none
+static volatile uint64_t mark_us = 0;       // when it was taken, 0 until then
+static volatile uint64_t last_step_us = 0;
+
+// opto fork edges straight from the gpio irq. homing waits on these instead of the events
+// ring, so the main loop's events stay where they are while we home
+static volatile uint32_t opto_edges = 0;
+static volatile uint32_t opto_edge_us = 0;
+
+// where seek_opto() found the edge
+typedef struct {
+    int taken;              // steps taken before we noticed
+    int step;               // index of the step that tripped the fork
+    uint32_t frac_x100;     // how far into that step's interval the edge came
+} opto_edge_t;
+
+static void wait_step(absolute_time_t *next, uint32_t interval_us);
+static bool seek_opto(int dir, const motion_plan_t *plan, uint32_t interval_us, int max_steps, opto_edge_t *edge);
+static bool home_to_opto(int search_dir, opto_edge_t *result);
+
+/**
+ finish bookkeeping, runs in the alarm irq or on cancel
+ */
+static void post_motion_done(void) {
+    events_post(EV_MOTION_DONE, 0);
 }
 
-// a really bad way of recalibrating the motor in the middle of a turn, but oh well
-void recalibrate_motor() {
-    event_t ev;
+static void motion_finish(void) {
+    uint64_t elapsed = time_us_64() - motion_start_us;
+    if (elapsed > 0 && active_index > 0) {
+        // elapsed covers every step's interval, the last one's dwell included
+        achieved_rate_x10 = (uint32_t)((uint64_t)active_index * 10000000 / elapsed);
+    }
+    motion_active = false;
+}
 
-    flush_events(); // clear events in que
+/**
+ take one step and schedule the next one, runs in the timer irq
+ */
+static int64_t motion_alarm_callback(alarm_id_t id, void *user_data) {
+    // the move is over once the last step has had its interval, so a move started
+    // straight after this one can't step early
+    if (active_index >= active_plan.steps) {
+        motion_finish();
+        if (active_notify) {
+            post_motion_done();
+        }
+        return 0; // done, don't reschedule
+    }
 
-    printf("Returning to opto detect...\n");
+    current_step = (current_step + motion_dir + COMPARTMENTS) % COMPARTMENTS;
+    run_motor(current_step);
+    last_step_us = time_us_64();
+    if (active_index == mark_index) {
+        mark_us = last_step_us;
+    }
+    if (backlash_left > 0) {
+        backlash_left--;
+    } else {
+        motion_pos += motion_dir;
+    }
 
+    uint32_t interval = motion_step_interval_us(&active_plan, active_index);
+    active_index++;
 
-    bool first_edge = false;
+    // negative = relative to when this alarm was due, so the timing doesn't drift
+    return -(int64_t)interval;
+}
 
-    while (!first_edge) {
-        current_step = (current_step - 1);
+/**
+ start a move and return straight away
+ with notify set, EV_MOTION_DONE lands in the events queue when the last step is taken
+ */
+bool motion_start(int steps, bool notify) {
+    return motion_start_marked(steps, notify, -1);
+}
 
-        if (current_step < 0) current_step = COMPARTMENTS - 1;  // wrap around
+/**
+ motion_start() that also timestamps the step mark_before_end steps from the end of
+ the move (0 is the last step), see motion_mark_us()
+ */
+bool motion_start_marked(int steps, bool notify, int mark_before_end) {
+    if (steps == 0 || motion_active) {
+        return false;
+    }
 
-        run_motor(current_step);
+    // reversing has to take up the gearbox slack before the carousel moves, those steps
+    // are added to the move but not to the position
+    int dir = steps > 0 ? 1 : -1;
+    backlash_left = dir != last_dir ? MOTION_BACKLASH_STEPS : 0;
+    motion_dir = dir;
+    last_dir = dir;
+
+    active_plan = motion_plan(steps * dir + backlash_left);
+    active_index = 0;
+    mark_us = 0;
+    mark_index = -1;
+    if (mark_before_end >= 0) {
+        mark_index = active_plan.steps - 1 - mark_before_end;
+        if (mark_index < 0) mark_index = 0;
+    }
+    motion_target_pos = motion_pos + steps;
+    active_notify = notify;
+    motion_start_us = time_us_64();
+    motion_active = true;
+
+    motion_alarm = add_alarm_in_us(0, motion_alarm_callback, NULL, true);
+    if (motion_alarm < 0) {
+        motion_active = false;
+        printf("Motion: no alarm available\n");
+        return false;
+    }
+
+    return true;
+}
 
-        sleep_ms(1);
+/**
+ stop a move between steps, returns how many steps were left
+ */
+int motion_cancel(void) {
+    if (!motion_active) {
+        return 0;
+    }
+
+    cancel_alarm(motion_alarm);
+    int remaining = active_plan.steps - active_index;
+    motion_finish();
+    motion_target_pos = motion_pos; // nothing left to finish after a reboot
+    return remaining;
+}
+
+bool motion_busy(void) {
+    return motion_active;
+}
+
+int32_t motion_position(void) {
+    return motion_pos;
+}
+
+/**
+ time the marked step of the last marked move was taken, 0 if it hasn't been yet
+ */
+uint64_t motion_mark_us(void) {
+    return mark_us;
+}
+
+uint64_t motion_last_step_us(void) {
+    return last_step_us;
+}
+
+int32_t motion_target(void) {
+    return motion_target_pos;
+}
+
+/**
+ we're aligned on compartment 0, positions count from here
+ */
+void motion_set_home(void) {
+    motion_pos = 0;
+    motion_target_pos = 0;
+    position_valid = true;
+}
+
+void motion_invalidate_position(void) {
+    position_valid = false;
+}
+
+/**
+ whether the position is worth saving: known, and the carousel standing still. a record
+ written mid move says no, so a reboot that cut the move short re-homes
+ */
+bool motion_position_valid(void) {
+    return position_valid && !motion_active;
+}
+
+/**
+ position and move intent from the saved record
+ */
+void motion_restore_position(int32_t position, int32_t target, bool valid) {
+    motion_pos = position;
+    motion_target_pos = target;
+    position_valid = valid;
+}
+
+/**
+ true if the restored position can be used as is: it was saved with the carousel at rest
+ at the end of a move. otherwise we have to home
+ */
+bool motion_resume(void) {
+    return position_valid && motion_target_pos == motion_pos;
+}
+
+/**
+ true if going from one compartment to another in dir doesn't pass over one that still
+ has a pill in it, those would drop through the hole on the way
+ */
+static bool path_is_clear(int from, int to, int dir) {
+    for (int c = (from + dir + COMPARTMENTS) % COMPARTMENTS; c != to; c = (c + dir + COMPARTMENTS) % COMPARTMENTS) {
+        if (c > pills_dispensed && c <= MAX_PILLS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ move to a compartment whichever way round is shorter, counting the backlash take-up
+ a reversal costs. a direction that would pass over full compartments is only used if
+ both are, and then forwards like it always was
+ */
+bool motion_goto_compartment(int compartment, bool notify) {
+    if (!position_valid || steps_per_compartment_q16 <= 0 || motion_active) {
+        return false;
+    }
+
+    int32_t rotation = compartment_offset(COMPARTMENTS);
+    int32_t here = ((motion_pos % rotation) + rotation) % rotation;
+    int from = compartment_at(here);
+    int to = ((compartment % COMPARTMENTS) + COMPARTMENTS) % COMPARTMENTS;
+
+    int32_t forward = ((compartment_offset(to) - here) % rotation + rotation) % rotation;
+    if (forward == 0) {
+        if (notify) {
+            // thread context, keep the irq producers out while we post
+            uint32_t irq_state = save_and_disable_interrupts();
+            post_motion_done();
+            restore_interrupts(irq_state);
+        }
+        return true;
+    }
+    int32_t backward = forward - rotation;
+
+    bool forward_ok = path_is_clear(from, to, 1);
+    bool backward_ok = path_is_clear(from, to, -1);
+    int32_t forward_cost = forward + (last_dir != 1 ? MOTION_BACKLASH_STEPS : 0);
+    int32_t backward_cost = -backward + (last_dir != -1 ? MOTION_BACKLASH_STEPS : 0);
+
+    int32_t steps = forward;
+    if (backward_ok && (!forward_ok || backward_cost < forward_cost)) {
+        steps = backward;
+    }
 
-        if (queue_try_remove(&events, &ev)) {
-            if (ev.type == EV_OPTO) {
-                // opto fork detected an edge
-                first_edge = true;
-                printf("Found opto edge...\n");
+    printf("Goto compartment %d from %d: %d steps\n", to, from, steps);
+    return motion_start(steps, notify);
+}
+
+/**
+ nearest compartment to a position, 0..COMPARTMENTS-1. the position is taken round the
+ wheel first, a recovery goto the short way backwards leaves it negative
+ */
+int compartment_at(int32_t position) {
+    if (steps_per_compartment_q16 <= 0) {
+        return 0;
+    }
+    int32_t rotation = compartment_offset(COMPARTMENTS);
+    position = ((position % rotation) + rotation) % rotation;
+    int nearest = (int)((((int64_t)position << 16) + steps_per_compartment_q16 / 2) / steps_per_compartment_q16);
+    return nearest % COMPARTMENTS;
+}
+
+uint32_t motor_achieved_rate_x10(void) {
+    return achieved_rate_x10;
+}
+
+/**
+ steps from the aligned home position to a compartment, rounded once from the fixed
+ point value so the fraction never piles up however many compartments we go
+ */
+int compartment_offset(int compartments) {
+    return (int)(((int64_t)compartments * steps_per_compartment_q16 + 0x8000) >> 16);
+}
+
+/**
+ steps for the move out of one compartment into the next. the error accumulator is
+ the fractional part of compartment_offset(), so it survives a reboot with the count
+ */
+int compartment_steps(int compartment) {
+    return compartment_offset(compartment + 1) - compartment_offset(compartment);
+}
+
+/**
+ wait for the next step slot. deadlines are absolute so the rate doesn't drift with
+ however long the step itself took
+ */
+static void wait_step(absolute_time_t *next, uint32_t interval_us) {
+    *next = delayed_by_us(*next, interval_us);
+    cpu_load_idle_begin();
+    sleep_until(*next);
+    cpu_load_idle_end();
+}
+
+/**
+ falling edge on the opto fork, call from the gpio irq
+ */
+void motor_opto_edge(uint32_t timestamp_us) {
+    opto_edge_us = timestamp_us;
+    opto_edges++;
+}
+
+/**
+ one half step forwards (dir 1) or backwards (dir -1)
+ */
+static void step_once(int dir) {
+    current_step = (current_step + dir + COMPARTMENTS) % COMPARTMENTS;
+    run_motor(current_step);
+    motion_pos += dir;
+    last_dir = dir;
+}
+
+// step timestamps kept by seek_opto(), enough to look back past any irq latency
+#define SEEK_HISTORY 16
+
+/**
+ step in one direction until the opto fork fires. the edge time from the irq is matched
+ against when each step was taken, so we know which step tripped it even if we only
+ noticed a few steps later, and how far into that step it happened.
+ with plan set the step timing follows it (ramping up), otherwise interval_us is used
+ */
+static bool seek_opto(int dir, const motion_plan_t *plan, uint32_t interval_us, int max_steps, opto_edge_t *edge) {
+    uint32_t step_us[SEEK_HISTORY];
+    absolute_time_t next = get_absolute_time();
+    uint32_t edges = opto_edges; // only edges from here on count
+
+    for (int taken = 0; taken < max_steps; ) {
+        step_once(dir);
+        step_us[taken % SEEK_HISTORY] = time_us_32();
+        taken++;
+
+        uint32_t interval = plan != NULL ? motion_step_interval_us(plan, taken - 1) : interval_us;
+        wait_step(&next, interval);
+
+        if (opto_edges != edges) {
+            uint32_t edge_us = opto_edge_us;
+
+            // newest step that was taken before the edge
+            int k = taken - 1;
+            while (k > 0 && k > taken - SEEK_HISTORY && (int32_t)(edge_us - step_us[k % SEEK_HISTORY]) < 0) {
+                k--;
             }
+
+            uint32_t step_interval = plan != NULL ? motion_step_interval_us(plan, k) : interval_us;
+            uint32_t into_step = edge_us - step_us[k % SEEK_HISTORY];
+            edge->taken = taken;
+            edge->step = k;
+            edge->frac_x100 = into_step >= step_interval ? 99 : into_step * 100 / step_interval;
+            return true;
         }
     }
 
-    for (int i = 0; i < COMPARTMENT_OFFSET; i++) {
-        current_step = (current_step - 1);
+    return false;
+}
+
+/**
+ two phase homing: ramp up to cruise in search_dir until the fork fires, then step
+ backwards until the slot is behind us and a little further. after a forward search
+ that reverses out of the slot, after a backward one it carries on through it. then
+ creep forwards onto the edge, so it's always approached forwards at the same speed,
+ the way calibrate() measured it. ends on the step that tripped the fork
+ */
+static bool home_to_opto(int search_dir, opto_edge_t *result) {
+    uint64_t start_us = time_us_64();
+    opto_edge_t fast, slow;
+
+    motion_plan_t search = motion_plan(HOMING_MAX_STEPS);
+    if (!seek_opto(search_dir, &search, 0, HOMING_MAX_STEPS, &fast)) {
+        return false;
+    }
+    uint64_t fast_us = time_us_64() - start_us;
+
+    // backwards at the start speed, no ramp needed: until the slot is behind us (it reads
+    // low while lit), then a bit further
+    motion_params_t params = motion_get_params();
+    uint32_t start_interval = 1000000 / params.start_sps;
+    absolute_time_t next = get_absolute_time();
+    int backoff = 0;
+
+    while (!gpio_get(OPTO_FORK) && backoff < HOMING_MAX_STEPS) {
+        step_once(-1);
+        wait_step(&next, start_interval);
+        backoff++;
+    }
+    for (int i = 0; i < HOMING_BACKOFF_STEPS; i++) {
+        step_once(-1);
+        wait_step(&next, start_interval);
+    }
+
+    // a wide flag can give a second edge on the way back, seek_opto() only counts new ones
+    if (!seek_opto(1, NULL, HOMING_SLOW_INTERVAL_US, 2 * HOMING_BACKOFF_STEPS, &slow)) {
+        return false;
+    }
 
-        if (current_step < 0) current_step = COMPARTMENTS - 1;
+    // step back onto the one that tripped it
+    next = get_absolute_time();
+    for (int i = slow.step + 1; i < slow.taken; i++) {
+        step_once(-1);
+        wait_step(&next, HOMING_SLOW_INTERVAL_US);
+    }
 
-        run_motor(current_step);
+    uint32_t total_us = (uint32_t)(time_us_64() - start_us);
+    printf("Homing: %u ms (search %u steps in %u ms, back off %d, approach %d), edge %u%% into the step\n",
+           total_us / 1000, fast.taken, (uint32_t)(fast_us / 1000), backoff + HOMING_BACKOFF_STEPS,
+           slow.taken, slow.frac_x100);
 
-        sleep_ms(1);
+    if (result != NULL) {
+        *result = slow;
     }
+    return true;
+}
 
-    // go until we reached the previous pill dispensed
+// a really bad way of recalibrating the motor in the middle of a turn, but oh well
+void recalibrate_motor() {
+    printf("Returning to opto detect...\n");
 
-    move_stepper(pills_dispensed * steps_per_compartment);
+    // search backwards, over the compartments that are already empty. home_to_opto()
+    // still ends on the edge calibrate() found, approached forwards
+    if (!home_to_opto(-1, NULL)) {
+        printf("Homing failed, can't recover position\n");
+        motion_invalidate_position();
+        calibrated = false;
+        state = S_ERROR;
+        led_blink_flag = true;
+        return;
+    }
+
+    // the same offset from the edge as calibrate() aligned to
+    absolute_time_t next = get_absolute_time();
+
+    for (int i = 0; i < COMPARTMENT_OFFSET; i++) {
+        step_once(1);
+        wait_step(&next, STEP_INTERVAL_US);
+    }
+    motion_set_home();
 
+    // back to the last compartment dispensed, or on to the one a dispense was heading for
+    // when it was cut short, in the background. the main loop sees EV_MOTION_DONE
+    int compartment = pills_dispensed + (dispensing_in_progress ? 1 : 0);
+    if (compartment > 0 && steps_per_compartment_q16 > 0) {
+        motion_goto_compartment(compartment, true);
+    }
 
 }
 
 void calibrate() {
-    event_t ev;
-    flush_events(); // clear que
+    motion_invalidate_position();
 
     printf("Looking for first edge...\n");
 
     // look for first opto detect
-    bool first_edge = false;
-    while (!first_edge) {
-        move_stepper(1);
-        if (queue_try_remove(&events, &ev)) {
-            if (ev.type == EV_OPTO) {
-                // opto fork detected an edge
-                first_edge = true;
-                printf("Found first edge. Starting measurement...\n");
-            }
-        }
+    if (!home_to_opto(1, NULL)) {
+        printf("Calibration failed: no opto edge found.\n");
+        calibrated = false;
+        return;
     }
+    printf("Found first edge. Starting measurement...\n");
 
-    // now count steps for one full revolution
-    int steps_count = 0;
-    bool edge_detected = false;
+    // count steps over several revolutions, the average keeps the fraction that a single
+    // revolution divided by COMPARTMENTS would throw away. each revolution is counted to
+    // the step that tripped the fork, steps taken past it count towards the next one
+    int total_steps = 0;
+    int overshoot = 0;
 
-    // move stepper until we hit opto detect again
-    while (!edge_detected) {
-        move_stepper(1);
-        steps_count++;
-
-        if (queue_try_remove(&events, &ev)) {
-            if (ev.type == EV_OPTO) {
-                edge_detected = true;
-            }
-        }
+    for (int rev = 0; rev < CALIBRATION_REVOLUTIONS; rev++) {
+        opto_edge_t edge;
 
-        // avoid infinite loop
-        if (steps_count > 10000) {
+        if (!seek_opto(1, NULL, STEP_INTERVAL_US, 10000, &edge)) {
             printf("Calibration failed: too many steps without detecting edge.\n");
             calibrated = false;
             return;
         }
-    }
 
-    // debug statement
-    // printf("Run 1: %d steps.\n", steps_count);
+        int steps_count = overshoot + edge.step + 1;
+        overshoot = edge.taken - (edge.step + 1);
+
+        printf("Revolution %d: %d steps\n", rev + 1, steps_count);
+        total_steps += steps_count;
+    }
 
     // Store the step count and calculate steps per compartment
-    steps_per_rotation = steps_count;
-    steps_per_compartment = (steps_per_rotation / COMPARTMENTS);
-    // fully align the compartment
-    move_stepper(COMPARTMENT_OFFSET);
+    steps_per_rotation = (total_steps + CALIBRATION_REVOLUTIONS / 2) / CALIBRATION_REVOLUTIONS;
+    steps_per_compartment_q16 = (int32_t)(((int64_t)total_steps << 16) / (CALIBRATION_REVOLUTIONS * COMPARTMENTS));
+    steps_per_compartment = (steps_per_compartment_q16 + 0x8000) >> 16;
+    // fully align the compartment, counting from the edge rather than where we stopped
+    move_stepper(COMPARTMENT_OFFSET - overshoot);
 
     // this *shouldn't* be 0 in any situation but idk
     if (steps_per_compartment <= 0) {
@@ -130,6 +543,7 @@ void calibrate() {
         return;
     }
 
+    motion_set_home();
     calibrated = true;
     printf("Calibrated.\n");
 }
@@ -141,6 +555,8 @@ void move_stepper(int steps) {
         return;
     }
 
+    TRACE_BEGIN(TRACE_MOVE_STEPPER);
+
     if (calibrated) {
         dispensing_in_progress = 1;
         if (eeprom_initialized) {
@@ -148,10 +564,14 @@ void move_stepper(int steps) {
         }
     }
 
-    for (int i = 0; i < steps; i++) {
-        current_step = (current_step + 1) % COMPARTMENTS;
-        run_motor(current_step);
-        sleep_ms(1);
+    // blocking move on top of the motion engine, for calibration and homing
+    if (motion_start(steps, false)) {
+        while (motion_busy()) {
+            cpu_load_idle_begin();
+            __wfi(); // every step is a timer irq, so this wakes per step
+            cpu_load_idle_end();
+            cpu_load_count_wakeup();
+        }
     }
 
     if (calibrated) {
@@ -160,11 +580,10 @@ void move_stepper(int steps) {
             save_state_to_eeprom(eeprom_i2c);
         }
     }
+
+    TRACE_END(TRACE_MOVE_STEPPER);
 }
 
 void run_motor(int step) {
-    gpio_put(IN1, half_step[step][0]);
-    gpio_put(IN2, half_step[step][1]);
-    gpio_put(IN3, half_step[step][2]);
-    gpio_put(IN4, half_step[step][3]);
+    gpio_put_masked(MOTOR_PIN_MASK, half_step_mask[step]);
 }
\ No newline at end of file
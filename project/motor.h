@@ -1,9 +1,33 @@
 #ifndef MOTOR_H
 #define MOTOR_H
+#include <stdint.h>
+#include <stdbool.h>
 //temp
 void calibrate();
 void move_stepper(int steps);
 void run_motor(int step);
-void flush_events();
 void recalibrate_motor();
+uint32_t motor_achieved_rate_x10(void);
+int compartment_offset(int compartments);
+int compartment_steps(int compartment);
+
+// non-blocking motion engine, negative steps turn backwards
+bool motion_start(int steps, bool notify);
+bool motion_start_marked(int steps, bool notify, int mark_before_end);
+uint64_t motion_mark_us(void);
+uint64_t motion_last_step_us(void);
+bool motion_goto_compartment(int compartment, bool notify);
+int motion_cancel(void);
+bool motion_busy(void);
+int32_t motion_position(void);
+int32_t motion_target(void);
+
+// absolute position, steps from the aligned home, kept across reboots
+void motion_set_home(void);
+void motion_invalidate_position(void);
+bool motion_position_valid(void);
+void motion_restore_position(int32_t position, int32_t target, bool valid);
+bool motion_resume(void);
+int compartment_at(int32_t position);
+void motor_opto_edge(uint32_t timestamp_us);
 #endif //MOTOR_H
\ No newline at end of file
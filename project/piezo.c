@@ -0,0 +1,102 @@
+// piezo.c
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "config.h"
+#include "events.h"
+#include "piezo_detect.h"
+#include "piezo.h"
+
+// PIEZO_GPIO is ADC1
+#define PIEZO_ADC_INPUT     (PIEZO_GPIO - 26)
+#define PIEZO_SAMPLE_US     (1000000 / PIEZO_SAMPLE_HZ)
+
+// two buffers, two dma channels chained to each other: while one fills, the irq works
+// through the other. a block is PIEZO_BLOCK_SAMPLES / PIEZO_SAMPLE_HZ long, the
+// detector has that long before its buffer gets overwritten
+static uint16_t sample_buf[2][PIEZO_BLOCK_SAMPLES];
+static int dma_chan[2];
+
+static piezo_detector_t detector;
+static piezo_stats_t stats;
+
+/**
+ one block is full. runs at the default priority like the other event producers
+ */
+static void piezo_dma_irq(void) {
+    for (int i = 0; i < 2; i++) {
+        uint32_t mask = 1u << dma_chan[i];
+        if (!(dma_hw->ints0 & mask)) {
+            continue;
+        }
+        dma_hw->ints0 = mask;
+
+        // the last sample landed just now, count back from here for the hit time
+        uint64_t block_end_us = time_us_64();
+
+        // ready for when the other channel chains back to this one
+        dma_channel_set_write_addr(dma_chan[i], sample_buf[i], false);
+
+        piezo_hit_t hits[2];
+        int found = piezo_detect_process(&detector, sample_buf[i], PIEZO_BLOCK_SAMPLES, hits, 2);
+
+        for (int h = 0; h < found; h++) {
+            uint32_t samples_ago = detector.samples - 1 - hits[h].sample;
+            events_post_at(EV_PIEZO, block_end_us - (uint64_t)samples_ago * PIEZO_SAMPLE_US, hits[h].confidence);
+            stats.hits++;
+            stats.last_confidence = hits[h].confidence;
+        }
+
+        stats.blocks++;
+        uint32_t took = (uint32_t)(time_us_64() - block_end_us);
+        if (took > stats.max_process_us) {
+            stats.max_process_us = took;
+        }
+    }
+}
+
+static void setup_channel(int i) {
+    dma_channel_config c = dma_channel_get_default_config(dma_chan[i]);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, DREQ_ADC);
+    channel_config_set_chain_to(&c, dma_chan[i ^ 1]);
+
+    dma_channel_configure(dma_chan[i], &c, sample_buf[i], &adc_hw->fifo, PIEZO_BLOCK_SAMPLES, false);
+    dma_channel_set_irq0_enabled(dma_chan[i], true);
+}
+
+void piezo_init(void) {
+    piezo_detect_config_t cfg = PIEZO_DETECT_DEFAULTS;
+    cfg.refractory = PIEZO_DEBOUNCE_MS * (PIEZO_SAMPLE_HZ / 1000);
+    piezo_detect_init(&detector, &cfg);
+
+    adc_init();
+    adc_gpio_init(PIEZO_GPIO);
+    adc_select_input(PIEZO_ADC_INPUT);
+    adc_fifo_setup(true, true, 1, false, false); // fifo on, dreq at 1 sample, no shift
+    adc_set_clkdiv(48000000.0f / PIEZO_SAMPLE_HZ - 1); // ADC clock is 48 MHz
+
+    dma_chan[0] = dma_claim_unused_channel(true);
+    dma_chan[1] = dma_claim_unused_channel(true);
+    setup_channel(0);
+    setup_channel(1);
+
+    irq_set_exclusive_handler(DMA_IRQ_0, piezo_dma_irq);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    dma_channel_start(dma_chan[0]);
+    adc_run(true);
+
+    printf("Piezo: sampling ADC%d at %d Hz, %d sample blocks\n",
+           PIEZO_ADC_INPUT, PIEZO_SAMPLE_HZ, PIEZO_BLOCK_SAMPLES);
+}
+
+piezo_stats_t piezo_get_stats(void) {
+    stats.noise = piezo_detect_noise(&detector);
+    return stats;
+}
@@ -0,0 +1,22 @@
+// piezo.h
+// piezo sampled by the ADC through DMA, hits from piezo_detect land in the events queue
+// as EV_PIEZO with the confidence in data
+
+#ifndef PIEZO_H
+#define PIEZO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint32_t blocks;            // sample blocks processed
+    uint32_t hits;
+    uint32_t max_process_us;    // slowest block through the detector
+    uint16_t noise;             // current noise floor, ADC counts
+    uint8_t last_confidence;
+} piezo_stats_t;
+
+void piezo_init(void);
+piezo_stats_t piezo_get_stats(void);
+
+#endif //PIEZO_H
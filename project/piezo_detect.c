@@ -0,0 +1,91 @@
+// piezo_detect.c
+
+#include <string.h>
+#include "piezo_detect.h"
+
+void piezo_detect_init(piezo_detector_t *d, const piezo_detect_config_t *cfg) {
+    memset(d, 0, sizeof(*d));
+    d->cfg = *cfg;
+}
+
+uint16_t piezo_detect_noise(const piezo_detector_t *d) {
+    return (uint16_t)(d->noise_q8 >> 8);
+}
+
+static uint8_t hit_confidence(int32_t peak, int32_t threshold) {
+    if (threshold <= 0 || peak >= 4 * threshold) {
+        return 100;
+    }
+    return (uint8_t)(50 + (int64_t)50 * (peak - threshold) / (3 * threshold));
+}
+
+/**
+ run a block of samples through the detector, state carries over between blocks.
+ returns the number of hits written
+ */
+int piezo_detect_process(piezo_detector_t *d, const uint16_t *samples, size_t count,
+                         piezo_hit_t *hits, int max_hits) {
+    const piezo_detect_config_t *cfg = &d->cfg;
+    int found = 0;
+
+    for (size_t i = 0; i < count; i++, d->samples++) {
+        int32_t x = (int32_t)samples[i] << 8;
+
+        if (!d->primed) {
+            d->baseline_q8 = x;
+            d->primed = true;
+        }
+
+        d->baseline_q8 += (x - d->baseline_q8) >> cfg->baseline_shift;
+
+        int32_t rectified = x > d->baseline_q8 ? x - d->baseline_q8 : d->baseline_q8 - x;
+        d->envelope_q8 -= d->envelope_q8 >> cfg->decay_shift;
+        if (rectified > d->envelope_q8) {
+            d->envelope_q8 = rectified;
+        }
+
+        int32_t threshold = (int32_t)(((int64_t)d->noise_q8 * cfg->threshold_x16) >> 4);
+        if (threshold < (int32_t)cfg->min_threshold << 8) {
+            threshold = (int32_t)cfg->min_threshold << 8;
+        }
+
+        if (d->in_burst) {
+            if (d->envelope_q8 > d->burst_peak_q8) {
+                d->burst_peak_q8 = d->envelope_q8;
+            }
+
+            uint32_t length = d->samples - d->burst_start;
+
+            if (length > cfg->max_burst) {
+                // sustained, that's vibration. make it the new normal
+                d->in_burst = false;
+                d->noise_q8 = d->envelope_q8;
+            } else if (d->envelope_q8 < d->burst_threshold_q8 / 2) {
+                d->in_burst = false;
+                d->holdoff = cfg->refractory;
+
+                if (found < max_hits) {
+                    piezo_hit_t *hit = &hits[found++];
+                    hit->sample = d->burst_start;
+                    hit->length = length;
+                    hit->peak = (uint16_t)(d->burst_peak_q8 >> 8);
+                    hit->noise = (uint16_t)(d->burst_noise_q8 >> 8);
+                    hit->confidence = hit_confidence(d->burst_peak_q8, d->burst_threshold_q8);
+                }
+            }
+        } else if (d->holdoff > 0) {
+            // ringing after a hit, neither a new hit nor noise
+            d->holdoff--;
+        } else if (d->envelope_q8 > threshold) {
+            d->in_burst = true;
+            d->burst_start = d->samples;
+            d->burst_peak_q8 = d->envelope_q8;
+            d->burst_threshold_q8 = threshold;
+            d->burst_noise_q8 = d->noise_q8;
+        } else {
+            d->noise_q8 += (d->envelope_q8 - d->noise_q8) >> cfg->noise_shift;
+        }
+    }
+
+    return found;
+}
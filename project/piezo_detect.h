@@ -0,0 +1,69 @@
+// piezo_detect.h
+// pill drop detector for raw piezo ADC samples: envelope follower against an adaptive
+// noise floor. no pico dependencies so recorded traces replay on a host (tools/piezo_replay.c)
+//
+// per sample:
+//   baseline   slow running mean, removes the bias of the piezo front end
+//   envelope   |sample - baseline| with instant attack and exponential decay
+//   noise      slow mean of the envelope while nothing is happening
+//   a burst starts when the envelope crosses threshold = max(min_threshold, noise * k)
+//   and ends when it falls under half of that. short bursts are hits, bursts longer
+//   than max_burst are vibration (the motor), they raise the noise floor instead
+
+#ifndef PIEZO_DETECT_H
+#define PIEZO_DETECT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint8_t baseline_shift;     // baseline follows over 2^n samples
+    uint8_t decay_shift;        // envelope decays over 2^n samples
+    uint8_t noise_shift;        // noise floor follows over 2^n samples
+    uint16_t threshold_x16;     // threshold as a multiple of the noise floor, x16
+    uint16_t min_threshold;     // ADC counts, the floor for a quiet sensor
+    uint32_t max_burst;         // samples, longer bursts aren't a pill
+    uint32_t refractory;        // samples ignored after a hit
+} piezo_detect_config_t;
+
+// tuned for 10 kHz, 12 bit samples
+#define PIEZO_DETECT_DEFAULTS { \
+    .baseline_shift = 10,       /* ~100 ms */ \
+    .decay_shift = 5,           /* ~3 ms */ \
+    .noise_shift = 12,          /* ~400 ms */ \
+    .threshold_x16 = 64,        /* 4x the noise floor */ \
+    .min_threshold = 40, \
+    .max_burst = 500,           /* 50 ms */ \
+    .refractory = 2000,         /* 200 ms */ \
+}
+
+typedef struct {
+    uint32_t sample;            // sample index where the burst started
+    uint32_t length;            // burst length in samples
+    uint16_t peak;              // envelope peak, ADC counts
+    uint16_t noise;             // noise floor when it started, ADC counts
+    uint8_t confidence;         // 50 at the threshold, 100 at 4x the threshold or more
+} piezo_hit_t;
+
+typedef struct {
+    piezo_detect_config_t cfg;
+    bool primed;
+    bool in_burst;
+    int32_t baseline_q8;        // Q24.8 ADC counts
+    int32_t envelope_q8;
+    int32_t noise_q8;
+    int32_t burst_peak_q8;
+    int32_t burst_threshold_q8;
+    int32_t burst_noise_q8;
+    uint32_t burst_start;
+    uint32_t holdoff;
+    uint32_t samples;           // samples seen so far
+} piezo_detector_t;
+
+void piezo_detect_init(piezo_detector_t *d, const piezo_detect_config_t *cfg);
+int piezo_detect_process(piezo_detector_t *d, const uint16_t *samples, size_t count,
+                         piezo_hit_t *hits, int max_hits);
+uint16_t piezo_detect_noise(const piezo_detector_t *d);
+
+#endif //PIEZO_DETECT_H
@@ -1,20 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <pico/util/queue.h>
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
 #include "hardware/i2c.h"
 #include "pico/time.h"
 #include "lorawan.h"
 #include "eeprom.h"
 #include "config.h"
 #include "motor.h"
+#include "cpu_load.h"
+#include "buttons.h"
+#include "leds.h"
+#include "events.h"
+#include "piezo.h"
+#include "trace.h"
 
 i2c_inst_t  *eeprom_i2c = i2c0;
 
 // globals
 int steps_per_rotation = 0;
 int steps_per_compartment = 0;
+int32_t steps_per_compartment_q16 = 0;
 int current_step = 0;
 int dispensing_in_progress = 0;
 int pills_dispensed = 0;
@@ -23,18 +31,39 @@ bool calibrated = false;
 bool dispense_pill_flag = false;
 bool led_blink_flag = false;
 
-bool lorawan_connected = false;
+volatile bool lorawan_connected = false;
 bool eeprom_initialized = false;
 
 system_state_t state = S_WAIT_CAL;
 
-uint32_t last_led_toggle = 0;
-uint32_t last_piezo_time = 0;
 uint32_t first_delay_start = 0;
 
-queue_t events;
 struct repeating_timer timer;
 
+// where the dispense in flight is, the main loop moves it along
+typedef enum {
+    DP_IDLE,
+    DP_MOVING,      // carousel turning, waiting for EV_MOTION_DONE
+    DP_DETECTING    // compartment open, waiting for the piezo
+} dispense_phase_t;
+
+static dispense_phase_t dispense_phase = DP_IDLE;
+static uint64_t dispense_start_us = 0;  // pill_dispenser() started the move
+static uint64_t align_us = 0;           // last step, compartment over the hole
+static uint64_t detect_deadline_us = 0; // hits stamped after this are too late
+static uint64_t hit_us = 0;             // piezo hit matched to this dispense, 0 if none yet
+static uint8_t piezo_confidence = 0;    // of that hit
+static uint32_t worst_dispense_ms = 0;
+
+// adaptive detection window, learned from when pills land relative to alignment
+static int32_t drop_mean_us = 0;
+static int32_t drop_dev_us = 0;
+static uint32_t drops_seen = 0;
+
+static uint32_t session_saved = 0;      // lorawan_session_changes() at the last save
+
+#define PIEZO_BLOCK_US ((uint64_t)PIEZO_BLOCK_SAMPLES * 1000000 / PIEZO_SAMPLE_HZ)
+
 
 // prototypes
 void init_all();
@@ -43,10 +72,15 @@ void init_motor_pin(uint gpio_pin);
 static void gpio_handler(uint gpio, uint32_t event_mask);
 bool pill_timer_callback(struct repeating_timer *t);
 void pill_dispenser();
+static void handle_dispense_event(const event_t *ev);
+static void handle_event(const event_t *ev);
+static void service_state(void);
+static void wait_for_event(void);
+static int64_t post_event_alarm(alarm_id_t id, void *user_data);
+static void dispense_motion_done(void);
+static void dispense_finish(bool pill_detected);
 
 void error_blink(uint led_pin);
-bool check_button_press(uint pin);
-bool check_long_press(uint pin, uint duration);
 
 
 int main() {
@@ -56,252 +90,434 @@ int main() {
 
     load_eeprom_state(eeprom_i2c, pill_timer_callback);
 
+    // everything arrives as an event from an irq (buttons, sensors, timers, the motion
+    // alarm). in between the core sleeps in wfi
     while (true) {
-        // curent time
-        uint32_t now = to_ms_since_boot(get_absolute_time());
-
-        // button presses
-        bool center_pressed = check_button_press(CENTER_BUTTON);
-        bool left_pressed = check_button_press(LEFT_BUTTON);
-
-        switch (state) {
-            case S_WAIT_CAL:
-                // blink LED
-                if (now - last_led_toggle >= 200) {
-                    gpio_put(CENTER_LED, !gpio_get(CENTER_LED));
-                    last_led_toggle = now;
-                }
-                if (center_pressed) {
-                    printf("Starting calibration...\n");
-                    lorawan_send_text(lorawan_connected, "Starting calibration...");
-
-                    calibrate();
-
-                    if (calibrated) {
-                        state = S_IDLE;
-                        gpio_put(CENTER_LED, 1);
-                        printf("Calibration done: %d steps/rev, %d steps/compartment\n",
-                               steps_per_rotation, steps_per_compartment);
-                        printf("IDLE: Press LEFT button to dispense.\n");
-                        lorawan_send_text(lorawan_connected, "Calibration done!");
-
-                        // save state after we've calibrated
-                        if (eeprom_initialized) {
-                            save_state_to_eeprom(eeprom_i2c);
-                        }
-                    } else {
-                        state = S_ERROR;
-                        led_blink_flag = true;
-                        printf("Calibration failed!\n");
-                        lorawan_send_text(lorawan_connected, "Calibration failed!");
+        event_t ev;
 
-                    }
-                }
-                break;
+        while (events_pop(&ev)) {
+            handle_event(&ev);
+        }
 
-            case S_IDLE:
-                if (left_pressed) {
-                    printf("Dispense sequence started.\n");
-                    lorawan_send_text(lorawan_connected, "Starting pill dispenser");
+        service_state();
+        wait_for_event();
+    }
+}
 
-                    pills_dispensed = 0;
-                    first_delay_start = now;
-                    state = S_FIRST_DELAY;
-                    gpio_put(CENTER_LED, 1);  // led to show we're in delay mode
+/**
+ sleep until the next interrupt, unless an event is already waiting.
+ interrupts are masked around the check so one landing in between still wakes wfi
+ */
+static void wait_for_event(void) {
+    uint32_t irq_state = save_and_disable_interrupts();
+
+    if (events_empty()) {
+        cpu_load_idle_begin();
+        __wfi();
+        cpu_load_idle_end();
+        cpu_load_count_wakeup();
+    }
 
-                    // save initial state when starting dispensing
-                    if (eeprom_initialized) {
-                        save_state_to_eeprom(eeprom_i2c);
-                    }
-                }
-                break;
-
-            case S_FIRST_DELAY:
-                // wait for the first pill delay
-                if (now - first_delay_start >= FIRST_PILL_DELAY) {
-                    gpio_put(CENTER_LED, 0);
-                    dispense_pill_flag = true;
-                    state = S_DISPENSE;
-                    // start repeating times
-                    add_repeating_timer_ms(TIME_BETWEEN_PILLS, pill_timer_callback, NULL, &timer);
-                }
-                break;
+    restore_interrupts(irq_state);
+}
 
-            case S_DISPENSE:
-                if (dispense_pill_flag) {
+/**
+ work that depends on the state rather than on one event, runs after every batch
+ */
+static void service_state(void) {
+    // blink while waiting for calibration, however we got into S_WAIT_CAL. an error
+    // burst gets to finish first, its last alarm wakes us to come back here
+    if (state == S_WAIT_CAL && (led_get_mode(CENTER_LED) == LED_OFF || led_get_mode(CENTER_LED) == LED_ON)) {
+        led_set_pattern(CENTER_LED, LED_PATTERN_BLINK(WAIT_CAL_BLINK_MS, WAIT_CAL_BLINK_MS));
+    }
 
-                    if (pills_dispensed >= MAX_PILLS) {
-                        printf("All pills dispensed.\n");
-                        lorawan_send_text(lorawan_connected, "All pills dispensed.");
-                        cancel_repeating_timer(&timer);
+    if (state == S_ERROR && led_blink_flag) {
+        error_blink(CENTER_LED);
+        led_blink_flag = false;
+    }
 
-                        state = S_WAIT_CAL;
+    // core 1 joined or lost the network, keep the cached session current for the next boot
+    if (eeprom_initialized && lorawan_session_changes() != session_saved) {
+        session_saved = lorawan_session_changes();
+        save_state_to_eeprom(eeprom_i2c);
+    }
 
-                        calibrated = false;
+    // start the next pill once it's due and the carousel is free
+    if (state == S_DISPENSE && dispense_pill_flag && dispense_phase == DP_IDLE && !motion_busy()) {
 
-                        if (eeprom_initialized) {
-                            save_state_to_eeprom(eeprom_i2c);
-                        }
-                    }
-                    else {
-                        dispense_pill_flag = false;
-                        pill_dispenser();
-
-                        // save state after dispensing
-                        if (eeprom_initialized) {
-                            save_state_to_eeprom(eeprom_i2c);
-                        }
-                    }
-                }
-                sleep_ms(10);
-                break;
+        if (pills_dispensed >= MAX_PILLS) {
+            printf("All pills dispensed.\n");
+            lorawan_send_event(UPLINK_EV_ALL_DISPENSED, pills_dispensed);
+            cancel_repeating_timer(&timer);
 
-            case S_ERROR:
-                if (led_blink_flag) {
-                    error_blink(CENTER_LED);
-                    led_blink_flag = false;
-                }
+            state = S_WAIT_CAL;
+
+            calibrated = false;
+
+            if (eeprom_initialized) {
+                save_state_to_eeprom(eeprom_i2c);
+            }
+        }
+        else {
+            dispense_pill_flag = false;
+            pill_dispenser();
+        }
+    }
+}
 
-                if (check_long_press(CENTER_BUTTON, LONG_PRESS_DURATION)) {
-                    printf("Resetting to calibration.\n");
-                    lorawan_send_text(lorawan_connected, "Resetting to calibration.");
+static void handle_event(const event_t *ev) {
+    // curent time
+    uint32_t now = to_ms_since_boot(get_absolute_time());
 
-                    state = S_WAIT_CAL;
-                    gpio_put(CENTER_LED, 0);
+    // button presses
+    bool center_pressed = ev->type == EV_BUTTON_PRESS && ev->data == CENTER_BUTTON;
+    bool left_pressed = ev->type == EV_BUTTON_PRESS && ev->data == LEFT_BUTTON;
+    bool center_long_press = ev->type == EV_BUTTON_LONG_PRESS && ev->data == CENTER_BUTTON;
 
-                    // reset saved state when resetting calibration
+    // holding RIGHT dumps the span trace, whatever state we're in
+    if (ev->type == EV_BUTTON_LONG_PRESS && ev->data == RIGHT_BUTTON) {
+        TRACE_DUMP();
+        return;
+    }
+
+    switch (state) {
+        case S_WAIT_CAL:
+            if (center_pressed) {
+                printf("Starting calibration...\n");
+                lorawan_send_event(UPLINK_EV_CAL_START, -1);
+
+                calibrate();
+
+                if (calibrated) {
+                    state = S_IDLE;
+                    led_set(CENTER_LED, true);
+                    printf("Calibration done: %d steps/rev, %d.%03d steps/compartment\n",
+                           steps_per_rotation, steps_per_compartment_q16 >> 16,
+                           (int)(((steps_per_compartment_q16 & 0xFFFF) * 1000) >> 16));
+                    printf("IDLE: Press LEFT button to dispense.\n");
+                    lorawan_send_event(UPLINK_EV_CAL_DONE, -1);
+
+                    // save state after we've calibrated
                     if (eeprom_initialized) {
-                        calibrated = false;
                         save_state_to_eeprom(eeprom_i2c);
                     }
+                } else {
+                    state = S_ERROR;
+                    led_blink_flag = true;
+                    printf("Calibration failed!\n");
+                    lorawan_send_event(UPLINK_EV_CAL_FAILED, -1);
+
                 }
-                sleep_ms(100);
-                break;
-        }
+            }
+            break;
+
+        case S_IDLE:
+            if (left_pressed) {
+                printf("Dispense sequence started.\n");
+                lorawan_send_event(UPLINK_EV_SEQUENCE_START, -1);
+
+                pills_dispensed = 0;
+                first_delay_start = now;
+                state = S_FIRST_DELAY;
+                // breathe while we wait, so the delay doesn't look like idle
+                led_set_pattern(CENTER_LED, LED_PATTERN_PULSE(FIRST_DELAY_PULSE_MS, FIRST_DELAY_PULSE_MS));
+                add_alarm_in_ms(FIRST_PILL_DELAY, post_event_alarm, (void*)EV_FIRST_DELAY_DONE, true);
+
+                // save initial state when starting dispensing
+                if (eeprom_initialized) {
+                    save_state_to_eeprom(eeprom_i2c);
+                }
+            }
+            break;
+
+        case S_FIRST_DELAY:
+            // wait for the first pill delay
+            if (ev->type == EV_FIRST_DELAY_DONE) {
+                led_set(CENTER_LED, false);
+                dispense_pill_flag = true;
+                state = S_DISPENSE;
+                // start repeating times
+                add_repeating_timer_ms(TIME_BETWEEN_PILLS, pill_timer_callback, NULL, &timer);
+            }
+            break;
+
+        case S_DISPENSE:
+            // motion done / piezo hits / detection timeout for the dispense in flight
+            handle_dispense_event(ev);
+            break;
+
+        case S_ERROR:
+            if (center_long_press) {
+                printf("Resetting to calibration.\n");
+                lorawan_send_event(UPLINK_EV_RESET, -1);
+
+                state = S_WAIT_CAL;
+                led_set(CENTER_LED, false);
+                motion_cancel(); // position means nothing once we recalibrate
+
+                // reset saved state when resetting calibration
+                if (eeprom_initialized) {
+                    calibrated = false;
+                    save_state_to_eeprom(eeprom_i2c);
+                }
+            }
+            break;
     }
 }
 
-// timer callback
-bool pill_timer_callback(struct repeating_timer *t) {
-    if (pills_dispensed >= MAX_PILLS) {
-        cancel_repeating_timer(&timer);
-        state = S_WAIT_CAL;
-        calibrated = false;
-
-        // Save final state after finishing all pills
-        if (eeprom_initialized) {
-            save_state_to_eeprom(eeprom_i2c);
-        }
+/**
+ one shot alarm that posts the event type passed as user data
+ */
+static int64_t post_event_alarm(alarm_id_t id, void *user_data) {
+    events_post((event_type_t)(uintptr_t)user_data, 0);
+    return 0;
+}
 
-        return false;
-    }
+// timer callback. the main loop starts the pill, or wraps up once they're all out, the
+// eeprom save that needs can't wait out a write cycle in here
+bool pill_timer_callback(struct repeating_timer *t) {
     dispense_pill_flag = true;
+
+    events_post(EV_DISPENSE_TICK, 0);
     return true;
 }
 
-// dispense one pill
+// dispense one pill: start the move and return, the main loop does the rest
 void pill_dispenser() {
+    TRACE_BEGIN(TRACE_DISPENSE);
     printf("Dispensing pill %d...\n", pills_dispensed+1);
 
-    lorawan_send_text(lorawan_connected, "Dispensing pill...\n");
+    lorawan_send_event(UPLINK_EV_DISPENSING, pills_dispensed);
+
+    eeprom_stats_reset(); // count bus traffic per dispense
 
-    flush_events();
-    last_piezo_time = 0; // reset piezo debounce timer
+    // no flush, piezo hits are matched to this move by timestamp
+    dispense_start_us = time_us_64();
+    hit_us = 0;
 
     // move one compartment
-    if (steps_per_compartment > 0) {
-        move_stepper(steps_per_compartment);
-    } else {
+    if (steps_per_compartment <= 0) {
         printf("Error: Invalid compartment step count.\n");
         error_blink(CENTER_LED);
         state = S_ERROR;
+        TRACE_END(TRACE_DISPENSE);
+        return;
+    }
+
+    // saved before the first step. the record says we're mid dispense and the position
+    // isn't to be trusted, so a power cut from here until the move is done re-homes and
+    // finishes this compartment
+    dispensing_in_progress = 1;
+    if (eeprom_initialized) {
+        save_state_to_eeprom(eeprom_i2c);
+    }
+
+    // whole steps to the next compartment, the fraction carries over to the one after
+    // the step where the hole starts to open gets timestamped, detection is armed from there
+    if (!motion_start_marked(compartment_steps(pills_dispensed), true, DETECT_ARM_LEAD_STEPS)) {
+        printf("Error: Could not start motor.\n");
+        dispensing_in_progress = 0;
+        state = S_ERROR;
+        led_blink_flag = true;
+        TRACE_END(TRACE_DISPENSE);
+        return;
+    }
+
+    dispense_phase = DP_MOVING;
+}
+
+/**
+ how long after alignment we keep waiting for the pill. the full timeout until a few
+ drops have been seen, then the usual landing time plus four deviations
+ */
+static uint32_t detect_window_ms(void) {
+    if (drops_seen < DETECT_WINDOW_LEARN) {
+        return DETECTION_TIMEOUT_MS;
+    }
+
+    int64_t window_ms = ((int64_t)drop_mean_us + 4 * (int64_t)drop_dev_us) / 1000;
+    if (window_ms < DETECT_WINDOW_MIN_MS) window_ms = DETECT_WINDOW_MIN_MS;
+    if (window_ms > DETECTION_TIMEOUT_MS) window_ms = DETECTION_TIMEOUT_MS;
+    return (uint32_t)window_ms;
+}
+
+static void detect_window_update(bool detected) {
+    if (!detected) {
+        // maybe the window was too tight, open it up again
+        // past the full timeout it can't open any further, stop there
+        drop_dev_us = drop_dev_us * 2 + DETECT_WINDOW_MIN_MS * 1000;
+        if (drop_dev_us > DETECTION_TIMEOUT_MS * 1000) {
+            drop_dev_us = DETECTION_TIMEOUT_MS * 1000;
+        }
+        return;
+    }
+
+    int32_t landed = hit_us > align_us ? (int32_t)(hit_us - align_us) : 0;
+    if (drops_seen == 0) {
+        drop_mean_us = landed;
+        drop_dev_us = landed / 2;
+    } else {
+        int32_t error = landed - drop_mean_us;
+        drop_mean_us += error / 4;
+        drop_dev_us += ((error < 0 ? -error : error) - drop_dev_us) / 4;
+    }
+    drops_seen++;
+}
+
+/**
+ events while dispensing
+ */
+static void handle_dispense_event(const event_t *ev) {
+    if (ev->type == EV_MOTION_DONE) {
+        dispense_motion_done();
+    } else if (ev->type == EV_PIEZO) {
+        // only hits between the hole starting to open and the window closing belong to
+        // this dispense, earlier ones are the motor or the last pill still rattling
+        uint64_t arm_us = motion_mark_us();
+        if (dispense_phase == DP_IDLE || arm_us == 0 || ev->timestamp_us < arm_us) {
+            return;
+        }
+        if (dispense_phase == DP_DETECTING && ev->timestamp_us > detect_deadline_us) {
+            return;
+        }
+
+        if (hit_us == 0) {
+            hit_us = ev->timestamp_us;
+            piezo_confidence = (uint8_t)ev->data;
+        }
+        if (dispense_phase == DP_DETECTING) {
+            dispense_finish(true);
+        }
+    } else if (ev->type == EV_DETECT_TIMEOUT) {
+        // stale alarms from earlier dispenses fail the time check
+        if (dispense_phase == DP_DETECTING && time_us_64() >= detect_deadline_us) {
+            dispense_finish(false);
+        }
+    }
+}
+
+/**
+ the carousel finished a move. either our compartment move, or the recovery replay
+ started by recalibrate_motor() at boot
+ */
+static void dispense_motion_done(void) {
+    dispensing_in_progress = 0;
+
+    if (dispense_phase != DP_MOVING) {
+        // recovery move. if it finished a dispense that was cut short, that compartment
+        // is open now and counts as dispensed, and the next pill waits for the timer.
+        // otherwise we're just back where we were and the next pill goes straight away
+        int reached = compartment_at(motion_position());
+        if (reached > pills_dispensed && reached <= MAX_PILLS) {
+            printf("Interrupted dispense of pill %d completed\n", reached);
+            pills_dispensed = reached;
+            // that was the last one, nothing to wait for
+            dispense_pill_flag = pills_dispensed >= MAX_PILLS;
+        } else {
+            dispense_pill_flag = true;
+        }
+
+        if (eeprom_initialized) {
+            save_state_to_eeprom(eeprom_i2c);
+        }
         return;
     }
 
     // increment the pill counter
     pills_dispensed++;
+    align_us = motion_last_step_us();
+    TRACE_BEGIN(TRACE_DETECT);
 
     // save state to eeprom AFTER we've moved one compartment
     if (eeprom_initialized) {
         save_state_to_eeprom(eeprom_i2c);
     }
 
+    // landed while the compartment was still lining up
+    if (hit_us != 0) {
+        dispense_finish(true);
+        return;
+    }
 
+    // the window runs from alignment, not from here, so the save above doesn't eat into
+    // it. the alarm waits one extra sample block for a hit right at the end to come through
+    detect_deadline_us = align_us + (uint64_t)detect_window_ms() * 1000;
+    dispense_phase = DP_DETECTING;
 
-    //sleep_ms(500); // wait for pill to drop
-
-    bool pill_detected = false;
-    uint32_t detection_start = to_ms_since_boot(get_absolute_time());
-    uint32_t detection_timeout = 1000; // 1 second wait for pill detection
-
-    // check for pill detection
+    uint64_t now_us = time_us_64();
+    uint64_t fire_us = detect_deadline_us + PIEZO_BLOCK_US;
+    add_alarm_in_us(fire_us > now_us ? fire_us - now_us : 0, post_event_alarm, (void*)EV_DETECT_TIMEOUT, true);
+}
 
-    event_t ev;
+/**
+ wrap up one dispense once we know whether the pill fell
+ */
+static void dispense_finish(bool pill_detected) {
+    TRACE_END(TRACE_DETECT);
+    TRACE_END(TRACE_DISPENSE);
+    dispense_phase = DP_IDLE;
+
+    uint32_t total_ms = (uint32_t)((time_us_64() - dispense_start_us) / 1000);
+    uint32_t move_ms = (uint32_t)((align_us - dispense_start_us) / 1000);
+    if (total_ms > worst_dispense_ms) {
+        worst_dispense_ms = total_ms;
+    }
 
-    while (to_ms_since_boot(get_absolute_time()) - detection_start < detection_timeout) {
-        if (queue_try_remove(&events, &ev)) {
-            if (ev.type == EV_PIEZO) {
-                printf("Pill detected\n");
-                lorawan_send_text(lorawan_connected, "Pill detected");
-                pill_detected = true;
-                break;
-            }
-        }
-        sleep_ms(10);
+    if (pill_detected) {
+        printf("Dispense took %u ms: move %u ms, pill landed %d ms after alignment\n", total_ms, move_ms,
+               (int32_t)((int64_t)(hit_us - align_us) / 1000));
+    } else {
+        printf("Dispense took %u ms: move %u ms, %u ms window\n", total_ms, move_ms, detect_window_ms());
     }
+    detect_window_update(pill_detected);
+    printf("Detection window now %u ms, slowest dispense %u ms\n", detect_window_ms(), worst_dispense_ms);
 
-    if (!pill_detected) {
+    if (pill_detected) {
+        printf("Pill detected (confidence %u%%)\n", piezo_confidence);
+        lorawan_send_event(UPLINK_EV_PILL_DETECTED, pills_dispensed - 1);
+    } else {
         printf("Pill NOT detected!\n");
-        lorawan_send_text(lorawan_connected, "Pill NOT detected!");
+        lorawan_send_event(UPLINK_EV_PILL_MISSED, pills_dispensed - 1);
         error_blink(CENTER_LED);
     }
 
     if (pills_dispensed >= MAX_PILLS) {
         printf("All pills dispensed\n");
-        lorawan_send_text(lorawan_connected, "All pills dispensed.");
+        lorawan_send_event(UPLINK_EV_ALL_DISPENSED, pills_dispensed);
         cancel_repeating_timer(&timer);
         state = S_WAIT_CAL;
         calibrated = false;
     }
-}
 
+    // save state after dispensing
+    if (eeprom_initialized) {
+        save_state_to_eeprom(eeprom_i2c);
 
-// error blink
-void error_blink(uint led_pin) {
-    for (int i = 0; i < ERROR_BLINK_COUNT; i++) {
-        gpio_put(led_pin, 1);
-        sleep_ms(100);
-        gpio_put(led_pin, 0);
-        sleep_ms(100);
+        eeprom_stats_t stats = eeprom_get_stats();
+        eeprom_journal_info_t journal = eeprom_get_journal_info();
+        printf("EEPROM this dispense: %u I2C bytes, %u write cycles, %u saves skipped; journal at slot %d (seq %u), %u compactions\n",
+               stats.i2c_bytes, stats.write_cycles, stats.saves_skipped, journal.head, journal.seq, journal.compactions);
+        eeprom_print_write_latency();
     }
-}
 
-// button check
-bool check_button_press(uint pin) {
-    if (!gpio_get(pin)) {
-        sleep_ms(20);
-        if (!gpio_get(pin)) {
-            while (!gpio_get(pin)) sleep_ms(10);
-            return true;
-        }
-    }
-    return false;
-}
-bool check_long_press(uint pin, uint duration) {
-    if (!gpio_get(pin)) {
-        uint32_t start = to_ms_since_boot(get_absolute_time());
-        while (!gpio_get(pin)) {
-            if (to_ms_since_boot(get_absolute_time()) - start >= duration) {
-                while (!gpio_get(pin)) sleep_ms(10);
-                return true;
-            }
-            sleep_ms(10);
-        }
-    }
-    return false;
+    lorawan_queue_stats_t lq = lorawan_get_queue_stats();
+    printf("LoRaWAN queue: %u queued, %u sent, %u failed, %u dropped, %u while down, peak %u, %u rx overflows\n",
+           lq.queued, lq.sent, lq.failed, lq.dropped + lq.ring_dropped, lq.while_down, lq.high_water, lq.rx_overflows);
+    lorawan_link_stats_t ls = lorawan_get_link_stats();
+    printf("LoRaWAN link: %u joins (up at %u ms), %u lost, %u of %u tries failed, %u on the cached session\n",
+           ls.joins, ls.up_ms, ls.losses, ls.failures, ls.attempts, ls.config_skipped);
+    events_print_stats();
+    piezo_stats_t ps = piezo_get_stats();
+    printf("Piezo: %u hits, noise floor %u, slowest block %u us\n", ps.hits, ps.noise, ps.max_process_us);
+    cpu_load_report();
+    printf("Motor: %u.%u steps/s achieved\n", motor_achieved_rate_x10() / 10, motor_achieved_rate_x10() % 10);
 }
 
 
+// error blink, runs on its own and leaves the LED off
+void error_blink(uint led_pin) {
+    led_set_pattern(led_pin, LED_PATTERN_BURST(ERROR_BLINK_COUNT, 100, 100));
+}
 
 void init_button(uint pin) {
     gpio_init(pin);
@@ -316,39 +532,23 @@ void init_motor_pin(uint pin) {
 }
 
 static void gpio_handler(uint gpio, uint32_t mask) {
-    if (mask & GPIO_IRQ_EDGE_FALL) {
-        uint32_t current_time = to_ms_since_boot(get_absolute_time());
+    if (buttons_gpio_irq(gpio, mask)) {
+        return;
+    }
 
+    if (mask & GPIO_IRQ_EDGE_FALL) {
         if (gpio == OPTO_FORK) {
-            event_t ev = {EV_OPTO, current_time};
-            queue_try_add(&events, &ev);
+            motor_opto_edge(time_us_32());
             // printf("Opto edge\n");
         }
-        else if (gpio == PIEZO_GPIO) {
-            // Apply debounce logic for piezo sensor
-            if (last_piezo_time == 0 || current_time - last_piezo_time >= PIEZO_DEBOUNCE_MS) {
-                event_t ev = {EV_PIEZO, current_time};
-                queue_try_add(&events, &ev);
-                last_piezo_time = current_time;
-                // printf("Piezo hit\n");
-            }
-        }
     }
 }
 
 
 void init_all() {
-    queue_init(&events, sizeof(event_t), 16);
-
-    // buttons
-    init_button(LEFT_BUTTON);
-    init_button(CENTER_BUTTON);
-    init_button(RIGHT_BUTTON);
 
     // leds
-    gpio_init(LEFT_LED);   gpio_set_dir(LEFT_LED, GPIO_OUT);
-    gpio_init(CENTER_LED); gpio_set_dir(CENTER_LED, GPIO_OUT);
-    gpio_init(RIGHT_LED);  gpio_set_dir(RIGHT_LED, GPIO_OUT);
+    leds_init();
 
     // motor pins
     init_motor_pin(IN1);
@@ -364,18 +564,21 @@ void init_all() {
     init_button(OPTO_FORK);
     gpio_set_irq_enabled(OPTO_FORK, GPIO_IRQ_EDGE_FALL, true);
 
-    init_button(PIEZO_GPIO);
-    gpio_set_irq_enabled(PIEZO_GPIO, GPIO_IRQ_EDGE_FALL, true);
+    // piezo goes through the ADC, not a gpio edge
+    piezo_init();
+
+    // buttons, debounced into press / release / long press events
+    buttons_init();
 
     // eeprom init
     eeprom_initialized = init_eeprom(eeprom_i2c);
 
     // lorawan init
-    init_lorawan();
-
-    lorawan_connected = lorawan_try_connect();
-    lorawan_send_text(lorawan_connected, "Device has booted.");
-
-    // set last piezo time to 0
-    last_piezo_time = 0;
+    // all modem I/O lives on core 1, it joins in the background and sends the boot event
+    // itself. the session the last boot saved lets it skip configuring the modem
+    lorawan_session_t session;
+    if (eeprom_initialized && eeprom_get_lorawan_session(&session)) {
+        lorawan_restore_session(session);
+    }
+    multicore_launch_core1(lorawan_core1_main);
 }
\ No newline at end of file
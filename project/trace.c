@@ -0,0 +1,105 @@
+// trace.c
+
+#include "pico/stdlib.h"
+#include "trace.h"
+
+#if TRACE_ENABLED
+
+#include <stdio.h>
+#include "pico/platform.h"
+#include "hardware/sync.h"
+#include "config.h"
+
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "trace ring size must be a power of two");
+
+typedef struct {
+    uint32_t time_us;
+    uint8_t span;
+    uint8_t begin;
+} trace_entry_t;
+
+// one ring per core so neither ever waits on the other, oldest entries get overwritten
+static trace_entry_t rings[2][TRACE_RING_SIZE];
+static volatile uint32_t heads[2] = {0};
+
+static const char *span_names[TRACE_SPAN_COUNT] = {
+    "dispense",
+    "detect",
+    "move_stepper",
+    "eeprom_write",
+    "eeprom_read",
+    "lora_send",
+    "lora_read",
+    "lora_probe",
+    "lora_config",
+    "lora_join",
+    "lora_tx_write",
+    "lora_tx_ack",
+    "lora_tx_done",
+};
+
+void trace_record(trace_span_t span, bool begin) {
+    uint core = get_core_num();
+    uint32_t head = heads[core];
+    trace_entry_t *e = &rings[core][head & (TRACE_RING_SIZE - 1)];
+
+    e->time_us = time_us_32();
+    e->span = (uint8_t)span;
+    e->begin = begin;
+
+    __dmb(); // entry written before the dump on the other core can see it
+    heads[core] = head + 1;
+}
+
+/**
+ print both rings, every end matched with the latest open begin of the same span, then
+ count / total / max per span. the other core keeps tracing while we print, so its
+ oldest entries may already be overwritten, that's fine for a debug dump
+ */
+void trace_dump(void) {
+    for (uint core = 0; core < 2; core++) {
+        uint32_t head = heads[core];
+        uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+        uint32_t open_us[TRACE_SPAN_COUNT] = {0};
+        bool open[TRACE_SPAN_COUNT] = {false};
+        uint32_t spans[TRACE_SPAN_COUNT] = {0};
+        uint64_t total_us[TRACE_SPAN_COUNT] = {0};
+        uint32_t max_us[TRACE_SPAN_COUNT] = {0};
+
+        printf("--- trace core %u, %u entries ---\n", core, count);
+
+        for (uint32_t i = head - count; i != head; i++) {
+            trace_entry_t e = rings[core][i & (TRACE_RING_SIZE - 1)];
+            if (e.span >= TRACE_SPAN_COUNT) {
+                continue;
+            }
+
+            if (e.begin) {
+                open[e.span] = true;
+                open_us[e.span] = e.time_us;
+                continue;
+            }
+            if (!open[e.span]) {
+                continue; // its begin fell off the ring
+            }
+
+            uint32_t took = e.time_us - open_us[e.span];
+            open[e.span] = false;
+            spans[e.span]++;
+            total_us[e.span] += took;
+            if (took > max_us[e.span]) {
+                max_us[e.span] = took;
+            }
+            printf("%10u %-13s %8u us\n", open_us[e.span], span_names[e.span], took);
+        }
+
+        for (int s = 0; s < TRACE_SPAN_COUNT; s++) {
+            if (spans[s] > 0) {
+                printf("%-13s %4u x, avg %8u us, max %8u us\n", span_names[s], spans[s],
+                       (uint32_t)(total_us[s] / spans[s]), max_us[s]);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,55 @@
+// trace.h
+// begin/end timestamps of named spans in a RAM ring per core, dumped over stdio on demand.
+// on by default in debug builds, gone entirely (no ring, no calls) when NDEBUG is set,
+// -DTRACE_ENABLED=0/1 overrides either way
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef TRACE_ENABLED
+#ifdef NDEBUG
+#define TRACE_ENABLED 0
+#else
+#define TRACE_ENABLED 1
+#endif
+#endif
+
+typedef enum {
+    TRACE_DISPENSE,         // pill_dispenser() to dispense_finish()
+    TRACE_DETECT,           // alignment to dispense_finish()
+    TRACE_MOVE_STEPPER,
+    TRACE_EEPROM_WRITE,
+    TRACE_EEPROM_READ,
+    TRACE_LORA_SEND,        // blocking lorawan_send_command()
+    TRACE_LORA_READ,
+    TRACE_LORA_PROBE,       // background link steps, command out to reply
+    TRACE_LORA_CONFIG,      // one per configuration command
+    TRACE_LORA_JOIN,
+    TRACE_LORA_TX_WRITE,    // uplink command into the uart
+    TRACE_LORA_TX_ACK,      // command out to the modem taking it
+    TRACE_LORA_TX_DONE,     // taken to +MSGHEX: Done
+    TRACE_SPAN_COUNT
+} trace_span_t;
+
+#if TRACE_ENABLED
+
+void trace_record(trace_span_t span, bool begin);
+void trace_dump(void);
+
+// thread context only, every core writes its own ring without locking
+#define TRACE_BEGIN(span)   trace_record((span), true)
+#define TRACE_END(span)     trace_record((span), false)
+#define TRACE_DUMP()        trace_dump()
+
+#else
+
+#define TRACE_BEGIN(span)   ((void)0)
+#define TRACE_END(span)     ((void)0)
+#define TRACE_DUMP()        ((void)0)
+
+#endif
+
+#endif //TRACE_H
@@ -0,0 +1,79 @@
+// uplink.c
+
+#include "uplink.h"
+
+static const char *event_names[UPLINK_EV_COUNT] = {
+    "boot",
+    "calibration started",
+    "calibration done",
+    "calibration failed",
+    "state restored",
+    "recovering",
+    "sequence started",
+    "dispensing",
+    "pill detected",
+    "pill missed",
+    "all dispensed",
+    "reset",
+};
+
+/**
+ encode up to UPLINK_MAX_EVENTS events into out
+ ages are taken relative to now_ms, returns the frame length or 0 if it doesn't fit
+ */
+size_t uplink_encode(const uplink_event_t *events, size_t count, uint32_t now_ms, uint8_t *out, size_t out_size) {
+    if (count > UPLINK_MAX_EVENTS) {
+        count = UPLINK_MAX_EVENTS;
+    }
+
+    size_t len = UPLINK_HEADER_SIZE + count * UPLINK_EVENT_SIZE;
+    if (len > out_size) {
+        return 0;
+    }
+
+    out[0] = (uint8_t)((UPLINK_FORMAT_VERSION << 4) | (count & 0x0F));
+
+    uint8_t *p = out + UPLINK_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t age = (now_ms - events[i].timestamp_ms) / UPLINK_AGE_UNIT_MS;
+        if (age > 0xFFFF) age = 0xFFFF;
+
+        p[0] = (uint8_t)((events[i].code << 4) | (events[i].flags & 0x0F));
+        p[1] = events[i].pill;
+        p[2] = (uint8_t)(age >> 8);
+        p[3] = (uint8_t)(age & 0xFF);
+        p += UPLINK_EVENT_SIZE;
+    }
+
+    return len;
+}
+
+/**
+ decode a frame, timestamp_ms of each event is its age in ms at send time
+ returns the number of events or -1 if the frame is malformed
+ */
+int uplink_decode(const uint8_t *frame, size_t len, uplink_event_t *events, size_t max_events) {
+    if (len < UPLINK_HEADER_SIZE || (frame[0] >> 4) != UPLINK_FORMAT_VERSION) {
+        return -1;
+    }
+
+    size_t count = frame[0] & 0x0F;
+    if (len != UPLINK_HEADER_SIZE + count * UPLINK_EVENT_SIZE || count > max_events) {
+        return -1;
+    }
+
+    const uint8_t *p = frame + UPLINK_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        events[i].code = p[0] >> 4;
+        events[i].flags = p[0] & 0x0F;
+        events[i].pill = p[1];
+        events[i].timestamp_ms = (uint32_t)((p[2] << 8) | p[3]) * UPLINK_AGE_UNIT_MS;
+        p += UPLINK_EVENT_SIZE;
+    }
+
+    return (int)count;
+}
+
+const char *uplink_event_name(uint8_t code) {
+    return code < UPLINK_EV_COUNT ? event_names[code] : "unknown";
+}
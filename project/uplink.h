@@ -0,0 +1,61 @@
+// uplink.h
+// compact binary event format for LoRaWAN uplinks, sent with AT+MSGHEX
+// no pico dependencies so the same code decodes frames on a host (tools/uplink_decode.c)
+//
+// frame layout:
+//   byte 0       format version (high nibble) | event count (low nibble)
+//   then per event, 4 bytes:
+//   byte 0       event code (high nibble) | status flags (low nibble)
+//   byte 1       pill index, UPLINK_NO_PILL if the event isn't about a pill
+//   byte 2..3    event age in 100 ms units when the frame was built, big endian, saturates
+//                (receive time minus age gives the event time)
+
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define UPLINK_FORMAT_VERSION 1
+#define UPLINK_HEADER_SIZE    1
+#define UPLINK_EVENT_SIZE     4
+#define UPLINK_MAX_EVENTS     12      // 49 bytes, fits the 51 byte payload limit at the slowest data rate
+#define UPLINK_MAX_PAYLOAD    (UPLINK_HEADER_SIZE + UPLINK_MAX_EVENTS * UPLINK_EVENT_SIZE)
+#define UPLINK_NO_PILL        0xFF
+#define UPLINK_AGE_UNIT_MS    100
+
+// event codes, 4 bits
+typedef enum {
+    UPLINK_EV_BOOT = 0,
+    UPLINK_EV_CAL_START,
+    UPLINK_EV_CAL_DONE,
+    UPLINK_EV_CAL_FAILED,
+    UPLINK_EV_STATE_RESTORED,
+    UPLINK_EV_RECOVERING,
+    UPLINK_EV_SEQUENCE_START,
+    UPLINK_EV_DISPENSING,
+    UPLINK_EV_PILL_DETECTED,
+    UPLINK_EV_PILL_MISSED,
+    UPLINK_EV_ALL_DISPENSED,
+    UPLINK_EV_RESET,
+    UPLINK_EV_COUNT
+} uplink_event_code_t;
+
+// status flags, 4 bits
+#define UPLINK_FLAG_CALIBRATED  0x1
+#define UPLINK_FLAG_DISPENSING  0x2
+#define UPLINK_FLAG_EEPROM_OK   0x4
+
+typedef struct {
+    uint8_t code;
+    uint8_t flags;
+    uint8_t pill;
+    uint32_t timestamp_ms;  // ms since boot on the device, age on the host side after decoding
+} uplink_event_t;
+
+size_t uplink_encode(const uplink_event_t *events, size_t count, uint32_t now_ms, uint8_t *out, size_t out_size);
+int uplink_decode(const uint8_t *frame, size_t len, uplink_event_t *events, size_t max_events);
+const char *uplink_event_name(uint8_t code);
+
+#endif //UPLINK_H
@@ -0,0 +1,165 @@
+// carousel.c
+// 28BYJ-48 on the four coil pins, a gear train with some slack, and the carousel with
+// the opto slot and the pills. the wheel turns the moment the coils change, no inertia.
+// angles count output half steps from where the slot starts, compartment 0 sits over
+// the hole COMPARTMENT_OFFSET past it, the others follow a revolution / COMPARTMENTS apart
+
+#include <stdlib.h>
+#include "config.h"
+#include "sim.h"
+#include "hw.h"
+
+#define COIL_MASK ((1u << IN1) | (1u << IN2) | (1u << IN3) | (1u << IN4))
+#define COILS(a, b, c, d) (((a) << IN1) | ((b) << IN2) | ((c) << IN3) | ((d) << IN4))
+
+// the rotor settles on whichever of these the coils make
+static const uint32_t coil_phase[8] = {
+    COILS(1,0,0,0), COILS(1,1,0,0), COILS(0,1,0,0), COILS(0,1,1,0),
+    COILS(0,0,1,0), COILS(0,0,1,1), COILS(0,0,0,1), COILS(1,0,0,1)
+};
+
+static sim_carousel_state_t wheel = { .phase = -1 };
+static sim_carousel_stats_t stats;
+static int last_dir = 0;
+static uint64_t last_step_us = 0;
+static uint64_t run_start_us = 0;       // first step after the motor was last quiet
+static bool opto_lit = false;
+
+static int32_t angle_of(int32_t output) {
+    int32_t a = output % SIM_STEPS_PER_REV;
+    return a < 0 ? a + SIM_STEPS_PER_REV : a;
+}
+
+static int32_t compartment_angle(int k) {
+    return (COMPARTMENT_OFFSET + k * SIM_STEPS_PER_REV / COMPARTMENTS) % SIM_STEPS_PER_REV;
+}
+
+static void update_opto(void) {
+    bool lit = angle_of(wheel.output) < SIM_OPTO_WIDTH;
+    if (lit != opto_lit) {
+        opto_lit = lit;
+        if (lit) {
+            stats.opto_edges++;
+        }
+    }
+    gpio_model_input(OPTO_FORK, !lit); // the fork pulls low while the slot lets light through
+}
+
+/**
+ a full compartment over the hole lets its pill go, it rings the piezo once it lands
+ */
+static void check_hole(void) {
+    int32_t a = angle_of(wheel.output);
+
+    for (int k = 0; k < COMPARTMENTS; k++) {
+        if (!(wheel.pills & (1u << k))) {
+            continue;
+        }
+
+        int32_t off = abs(a - compartment_angle(k));
+        if (off > SIM_STEPS_PER_REV / 2) {
+            off = SIM_STEPS_PER_REV - off;
+        }
+        if (off <= SIM_DROP_LEAD) {
+            wheel.pills &= ~(1u << k);
+            stats.pills_dropped++;
+            uint64_t lands = sim_now_us() + (uint64_t)sim_rand_range(SIM_FALL_MIN_US, SIM_FALL_MAX_US);
+            piezo_model_hit(lands, sim_rand_range(SIM_HIT_MIN, SIM_HIT_MAX));
+        }
+    }
+}
+
+static void turn(int dir) {
+    wheel.motor += dir;
+    stats.steps++;
+    if (last_dir != 0 && dir != last_dir) {
+        stats.reversals++;
+    }
+    last_dir = dir;
+    if (sim_now_us() - last_step_us > SIM_VIBRATION_US) {
+        run_start_us = sim_now_us();
+    }
+    last_step_us = sim_now_us();
+
+    // the output only follows once the slack is taken up
+    if (wheel.motor - wheel.output > SIM_BACKLASH_STEPS) {
+        wheel.output = wheel.motor - SIM_BACKLASH_STEPS;
+    } else if (wheel.motor < wheel.output) {
+        wheel.output = wheel.motor;
+    } else {
+        return;
+    }
+
+    stats.position = wheel.output;
+    update_opto();
+    check_hole();
+}
+
+/**
+ the coil pins changed. a neighbouring half step turns the rotor one step, the same
+ pattern or all coils off leaves it where it is, anything further it can't follow
+ */
+void carousel_outputs_changed(uint32_t outputs) {
+    uint32_t coils = outputs & COIL_MASK;
+    int phase = -1;
+
+    for (int i = 0; i < 8; i++) {
+        if (coil_phase[i] == coils) {
+            phase = i;
+        }
+    }
+    if (phase < 0 || phase == wheel.phase) {
+        return;
+    }
+    if (wheel.phase < 0) {
+        wheel.phase = phase; // first time powered, it snaps into place
+        return;
+    }
+
+    int delta = (phase - wheel.phase + 8) % 8;
+    wheel.phase = phase;
+
+    if (delta == 1) {
+        turn(1);
+    } else if (delta == 7) {
+        turn(-1);
+    } else {
+        stats.skipped++;
+    }
+}
+
+/**
+ fill every compartment but the home one and the ones in missing
+ */
+void carousel_load_pills(uint8_t missing) {
+    uint8_t pills = 0;
+    for (int k = 1; k < COMPARTMENTS && k <= MAX_PILLS; k++) {
+        if (!(missing & (1u << k))) {
+            pills |= 1u << k;
+        }
+    }
+    wheel.pills = pills;
+    stats.pills_loaded += __builtin_popcount(pills);
+}
+
+/**
+ the frame shakes from the first step of a run until a little after the last one
+ */
+bool carousel_vibrating(uint64_t t_us) {
+    return last_step_us != 0 && t_us >= run_start_us && t_us < last_step_us + SIM_VIBRATION_US;
+}
+
+sim_carousel_state_t carousel_get_state(void) {
+    return wheel;
+}
+
+void carousel_set_state(const sim_carousel_state_t *s) {
+    wheel = *s;
+    wheel.phase = -1; // unpowered across the restart
+    stats.position = wheel.output;
+    update_opto();
+}
+
+sim_carousel_stats_t carousel_get_stats(void) {
+    return stats;
+}
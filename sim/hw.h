@@ -0,0 +1,125 @@
+// hw.h
+// the hardware around the pico, as seen by the stand-in SDK: stepper and carousel with
+// the opto fork and the pills, the piezo under the hole, the 24LC256 and the LoRa modem
+
+#ifndef SIM_HW_H
+#define SIM_HW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// carousel mechanics
+#define SIM_STEPS_PER_REV   4100    // not a multiple of COMPARTMENTS, so the Q16 plan has a fraction to carry
+#define SIM_BACKLASH_STEPS  12      // gear slack, a bit under what the firmware takes up
+#define SIM_OPTO_WIDTH      24      // steps the slot keeps the fork lit
+#define SIM_DROP_LEAD       32      // a pill falls once its compartment is this close to the hole
+#define SIM_FALL_MIN_US     60000   // from falling to hitting the piezo
+#define SIM_FALL_MAX_US     110000
+
+// piezo front end, 12 bit ADC counts
+#define SIM_PIEZO_BIAS      2048
+#define SIM_PIEZO_NOISE     4       // +- on every sample
+#define SIM_PIEZO_VIBRATION 12      // extra +- for a while after every motor step
+#define SIM_VIBRATION_US    3000
+#define SIM_HIT_MIN         300     // peak of a pill hit
+#define SIM_HIT_MAX         900
+#define SIM_HIT_HZ          2200    // ringing frequency
+#define SIM_HIT_TAU_US      4000    // ringing decay
+#define SIM_HITS            8       // hits still ringing at once, at most
+
+// 24LC256
+#define SIM_EEPROM_WRITE_MIN_US 3000    // internal write cycle, the datasheet's max is 5 ms
+#define SIM_EEPROM_WRITE_MAX_US 4500
+
+// uart and modem
+#define SIM_UART_FIFO       32      // bytes, tx and rx
+// modem timing until a script says otherwise
+#define SIM_MODEM_REPLY_US  5000    // command to first reply line
+#define SIM_MODEM_JOIN_US   6000000 // AT+JOIN to +JOIN: Done
+#define SIM_MODEM_TX_US     2200000 // AT+MSGHEX to +MSGHEX: Done, both rx windows included
+
+typedef struct {
+    uint32_t steps;             // coil changes that turned the rotor
+    uint32_t reversals;
+    uint32_t skipped;           // coil changes the rotor couldn't follow
+    uint32_t opto_edges;        // falling edges, slot into the fork
+    uint32_t pills_loaded;
+    uint32_t pills_dropped;
+    int32_t position;           // output shaft, half steps
+} sim_carousel_stats_t;
+
+typedef struct {
+    uint32_t blocks;
+    uint32_t samples;
+    uint32_t hits;              // pill hits rung into the signal
+    uint32_t overruns;          // a channel restarted before its irq re-armed it
+} sim_piezo_stats_t;
+
+typedef struct {
+    uint32_t bytes;             // on the bus, address bytes included
+    uint32_t transfers;
+    uint32_t nacks;             // addressed while a write cycle was running
+    uint32_t write_cycles;
+    uint32_t bytes_written;     // into the array
+} sim_i2c_stats_t;
+
+typedef struct {
+    uint32_t tx_bytes;          // pico -> modem
+    uint32_t rx_bytes;          // modem -> pico
+    uint32_t rx_overruns;       // bytes lost to a full rx fifo
+    uint32_t commands;
+    uint32_t uplinks;
+    uint32_t uplink_bytes;      // payload only
+    uint32_t join_failures;     // what the modem did wrong, on purpose
+    uint32_t uplink_failures;
+    uint32_t busy;
+    uint32_t errors;
+    uint32_t silent;
+    uint32_t garbage;
+    bool joined;
+} sim_uart_stats_t;
+
+// where the carousel is, kept across runs with --state
+typedef struct {
+    int32_t motor;              // rotor, half steps
+    int32_t output;             // carousel, lags the rotor by up to the backlash
+    int8_t phase;               // coil pattern the rotor sits on, -1 unpowered
+    uint8_t pills;              // bit per compartment
+} sim_carousel_state_t;
+
+// hw_gpio.c
+void gpio_model_input(uint32_t gpio, bool level);
+uint32_t gpio_model_outputs(void);
+
+// carousel.c
+void carousel_outputs_changed(uint32_t outputs);
+void carousel_load_pills(uint8_t missing);
+bool carousel_vibrating(uint64_t t_us);
+sim_carousel_state_t carousel_get_state(void);
+void carousel_set_state(const sim_carousel_state_t *s);
+sim_carousel_stats_t carousel_get_stats(void);
+
+// hw_adc.c
+void piezo_model_hit(uint64_t at_us, int32_t peak);
+sim_piezo_stats_t piezo_model_get_stats(void);
+void piezo_model_record(FILE *f);
+
+// hw_i2c.c
+uint8_t *eeprom_model_memory(void);
+sim_i2c_stats_t i2c_model_get_stats(void);
+
+// hw_uart.c, a byte from the modem has arrived
+void uart_model_receive(uint8_t c);
+uint64_t uart_model_char_us(void);
+sim_uart_stats_t *uart_model_stats(void);
+
+// modem.c
+void modem_model_init(void);
+void modem_model_byte(uint8_t c, uint64_t at_us);
+void modem_model_leave(void);
+const char *modem_model_last_uplink(void);
+bool modem_model_script(const char *path);
+
+#endif //SIM_HW_H
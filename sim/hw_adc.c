@@ -0,0 +1,244 @@
+// hw_adc.c
+// the ADC free running into the dma channels the firmware chains, and the piezo signal
+// it samples: bias, noise, motor vibration and the ringing of pills landing
+
+#include <math.h>
+#include <stdio.h>
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "sim.h"
+#include "hw.h"
+
+#define ADC_CLOCK_HZ 48000000.0
+
+typedef struct {
+    bool claimed;
+    dma_channel_config config;
+    volatile uint16_t *base;        // where the firmware last pointed it
+    volatile uint16_t *write_addr;  // where the next sample goes
+    uint32_t count;
+    bool irq0;
+} sim_dma_channel_t;
+
+typedef struct {
+    uint64_t at_us;
+    int32_t peak;
+} sim_hit_t;
+
+static adc_hw_t adc_regs;
+static dma_hw_t dma_regs;
+adc_hw_t *adc_hw = &adc_regs;
+dma_hw_t *dma_hw = &dma_regs;
+
+static sim_dma_channel_t channels[NUM_DMA_CHANNELS];
+static int active = -1;         // channel the ADC is feeding
+static bool adc_running = false;
+static float adc_div = 0;
+static uint64_t block_start_us = 0;
+static int block_event = 0;
+
+static sim_hit_t hits[SIM_HITS];
+static int next_hit = 0;
+static sim_piezo_stats_t stats;
+static FILE *record = NULL;     // every sample the firmware gets, for tools/piezo_replay
+
+void piezo_model_hit(uint64_t at_us, int32_t peak) {
+    hits[next_hit] = (sim_hit_t){ at_us, peak };
+    next_hit = (next_hit + 1) % SIM_HITS;
+    stats.hits++;
+}
+
+sim_piezo_stats_t piezo_model_get_stats(void) {
+    return stats;
+}
+
+/**
+ write every sample that reaches the firmware to f, one per line, NULL stops
+ */
+void piezo_model_record(FILE *f) {
+    record = f;
+}
+
+static uint16_t piezo_sample(uint64_t t_us) {
+    double v = SIM_PIEZO_BIAS + sim_rand_range(-SIM_PIEZO_NOISE, SIM_PIEZO_NOISE);
+
+    if (carousel_vibrating(t_us)) {
+        v += sim_rand_range(-SIM_PIEZO_VIBRATION, SIM_PIEZO_VIBRATION);
+    }
+
+    for (int i = 0; i < SIM_HITS; i++) {
+        if (hits[i].peak == 0 || t_us < hits[i].at_us || t_us - hits[i].at_us > 10 * SIM_HIT_TAU_US) {
+            continue;
+        }
+        double dt = (double)(t_us - hits[i].at_us) / 1e6;
+        v += hits[i].peak * exp(-dt * 1e6 / SIM_HIT_TAU_US) * sin(2 * M_PI * SIM_HIT_HZ * dt);
+    }
+
+    if (v < 0) v = 0;
+    if (v > 4095) v = 4095;
+    return (uint16_t)v;
+}
+
+static double sample_us(void) {
+    return (1.0 + adc_div) * 1e6 / ADC_CLOCK_HZ;
+}
+
+static void block_done(void *arg);
+
+static void start_block(void) {
+    if (!adc_running || active < 0 || block_event != 0) {
+        return;
+    }
+    block_start_us = sim_now_us();
+    uint64_t length = (uint64_t)llround(channels[active].count * sample_us());
+    block_event = sim_at(block_start_us + length, block_done, NULL);
+}
+
+/**
+ the active channel is full. the irq gets it, the channel it chains to takes over
+ */
+static void block_done(void *arg) {
+    sim_dma_channel_t *ch = &channels[active];
+    uint64_t end_us = sim_now_us();
+    double period = sample_us();
+
+    block_event = 0;
+
+    // a channel the irq hasn't re-armed would write past its buffer on the chip,
+    // here the block is dropped instead of scribbling over the host's memory
+    if (ch->write_addr != ch->base) {
+        stats.overruns++;
+    } else {
+        for (uint32_t i = 0; i < ch->count; i++) {
+            uint64_t t = end_us - (uint64_t)llround((ch->count - 1 - i) * period);
+            ch->write_addr[i] = piezo_sample(t);
+            if (record != NULL) {
+                fprintf(record, "%u\n", ch->write_addr[i]);
+            }
+        }
+        ch->write_addr += ch->count;
+        stats.samples += ch->count;
+    }
+    stats.blocks++;
+
+    int done = active;
+    active = ch->config.chain_to != (uint)done ? (int)ch->config.chain_to : -1;
+    start_block();
+
+    if (ch->irq0) {
+        // ints0 is write 1 to clear on the chip, which a plain struct can't do. the last
+        // block's irq acked long ago, so its bit is just replaced with this channel's
+        dma_hw->ints0 = 1u << done;
+        sim_irq_raise(DMA_IRQ_0);
+    }
+}
+
+void adc_init(void) {
+    adc_running = false;
+}
+
+void adc_gpio_init(uint gpio) {
+}
+
+void adc_select_input(uint input) {
+}
+
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh, bool err_in_fifo, bool byte_shift) {
+}
+
+void adc_set_clkdiv(float clkdiv) {
+    adc_div = clkdiv;
+}
+
+void adc_run(bool run) {
+    adc_running = run;
+    if (run) {
+        start_block();
+    } else if (block_event != 0) {
+        sim_cancel(block_event);
+        block_event = 0;
+    }
+}
+
+int dma_claim_unused_channel(bool required) {
+    for (int i = 0; i < NUM_DMA_CHANNELS; i++) {
+        if (!channels[i].claimed) {
+            channels[i].claimed = true;
+            return i;
+        }
+    }
+    if (required) {
+        fprintf(stderr, "sim: no free dma channel\n");
+    }
+    return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    dma_channel_config c = {
+        .size = DMA_SIZE_32,
+        .read_increment = true,
+        .write_increment = false,
+        .dreq = 0x3f,
+        .chain_to = channel
+    };
+    return c;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) {
+    c->size = size;
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) {
+    c->read_increment = incr;
+}
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) {
+    c->write_increment = incr;
+}
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq) {
+    c->dreq = dreq;
+}
+
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to) {
+    c->chain_to = chain_to;
+}
+
+/**
+ only what the piezo needs: 16 bit samples from the ADC fifo into an incrementing buffer
+ */
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger) {
+    sim_dma_channel_t *ch = &channels[channel];
+
+    if (config->dreq != DREQ_ADC || config->size != DMA_SIZE_16 || !config->write_increment) {
+        fprintf(stderr, "sim: dma channel %u set up for something other than ADC samples\n", channel);
+    }
+
+    ch->config = *config;
+    ch->base = write_addr;
+    ch->write_addr = write_addr;
+    ch->count = transfer_count;
+
+    if (trigger) {
+        dma_channel_start(channel);
+    }
+}
+
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger) {
+    channels[channel].base = write_addr;
+    channels[channel].write_addr = write_addr;
+    if (trigger) {
+        dma_channel_start(channel);
+    }
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled) {
+    channels[channel].irq0 = enabled;
+}
+
+void dma_channel_start(uint channel) {
+    active = (int)channel;
+    start_block();
+}
@@ -0,0 +1,61 @@
+// hw_core.c
+// irq control, interrupt masking, wfi/wfe/sev and core 1, all handed to the scheduler
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/rand.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "sim.h"
+
+uint get_core_num(void) {
+    return (uint)sim_core();
+}
+
+bool stdio_init_all(void) {
+    return true; // printf goes straight to the host's stdout
+}
+
+uint32_t get_rand_32(void) {
+    return sim_rand();
+}
+
+void tight_loop_contents(void) {
+    sim_clock_read();
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) {
+    sim_irq_set_handler(num, handler);
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+    sim_irq_set_enabled(num, enabled);
+}
+
+void irq_set_priority(uint num, uint8_t priority) {
+    // everything runs at one level here, same as the firmware sets it up
+}
+
+uint32_t save_and_disable_interrupts(void) {
+    return sim_irq_save();
+}
+
+void restore_interrupts(uint32_t status) {
+    sim_irq_restore(status);
+}
+
+void __wfi(void) {
+    sim_wait(SIM_FOREVER, false);
+}
+
+void __wfe(void) {
+    sim_wait(SIM_FOREVER, true);
+}
+
+void __sev(void) {
+    sim_sev();
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    sim_launch_core(1, entry);
+}
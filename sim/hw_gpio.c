@@ -0,0 +1,177 @@
+// hw_gpio.c
+// pins and the bank 0 irq. outputs go to the carousel model, inputs are driven by the
+// models (opto, buttons) and read back through the pulls when nothing drives them
+
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/pwm.h"
+#include "sim.h"
+#include "hw.h"
+
+#define SIM_GPIOS 30
+
+typedef struct {
+    bool out;               // direction
+    bool pull_up;
+    bool pull_down;
+    bool driven;            // a model holds the input at level
+    bool level;             // input level while driven
+    uint32_t irq_mask;
+    uint16_t pwm_level;
+} sim_pin_t;
+
+static sim_pin_t pins[SIM_GPIOS];
+static uint32_t outputs = 0;
+static gpio_irq_callback_t irq_callback = NULL;
+
+static bool input_level(const sim_pin_t *p) {
+    if (p->driven) {
+        return p->level;
+    }
+    return p->pull_up; // floating reads low unless pulled up
+}
+
+static void gpio_irq(void *arg) {
+    uint32_t packed = (uint32_t)(uintptr_t)arg;
+    if (irq_callback != NULL) {
+        irq_callback(packed & 0xFF, packed >> 8);
+    }
+}
+
+/**
+ a model drives gpio. edges the firmware asked for raise the bank 0 irq
+ */
+void gpio_model_input(uint32_t gpio, bool level) {
+    if (gpio >= SIM_GPIOS) {
+        return;
+    }
+
+    sim_pin_t *p = &pins[gpio];
+    bool before = input_level(p);
+    p->driven = true;
+    p->level = level;
+
+    if (level == before || p->out) {
+        return;
+    }
+
+    uint32_t edge = level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+    if (p->irq_mask & edge) {
+        sim_irq_call(IO_IRQ_BANK0, gpio_irq, (void *)(uintptr_t)(gpio | (edge << 8)));
+    }
+}
+
+uint32_t gpio_model_outputs(void) {
+    return outputs;
+}
+
+void gpio_init(uint gpio) {
+    if (gpio < SIM_GPIOS) {
+        pins[gpio].out = false;
+        pins[gpio].irq_mask = 0;
+        outputs &= ~(1u << gpio);
+    }
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+    if (gpio < SIM_GPIOS) {
+        pins[gpio].out = out;
+    }
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn) {
+    // peripherals are wired up by the models, nothing to route
+}
+
+void gpio_pull_up(uint gpio) {
+    if (gpio < SIM_GPIOS) {
+        pins[gpio].pull_up = true;
+        pins[gpio].pull_down = false;
+    }
+}
+
+void gpio_pull_down(uint gpio) {
+    if (gpio < SIM_GPIOS) {
+        pins[gpio].pull_up = false;
+        pins[gpio].pull_down = true;
+    }
+}
+
+void gpio_disable_pulls(uint gpio) {
+    if (gpio < SIM_GPIOS) {
+        pins[gpio].pull_up = false;
+        pins[gpio].pull_down = false;
+    }
+}
+
+bool gpio_get(uint gpio) {
+    if (gpio >= SIM_GPIOS) {
+        return false;
+    }
+    sim_clock_read(); // polling a pin is busy waiting as much as polling the clock
+    return pins[gpio].out ? (outputs >> gpio) & 1 : input_level(&pins[gpio]);
+}
+
+void gpio_put_masked(uint32_t mask, uint32_t value) {
+    uint32_t before = outputs;
+    outputs = (outputs & ~mask) | (value & mask);
+
+    if (outputs != before) {
+        carousel_outputs_changed(outputs);
+    }
+}
+
+void gpio_put(uint gpio, bool value) {
+    if (gpio < SIM_GPIOS) {
+        gpio_put_masked(1u << gpio, value ? 1u << gpio : 0);
+    }
+}
+
+void gpio_set_irq_callback(gpio_irq_callback_t callback) {
+    irq_callback = callback;
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled) {
+    if (gpio >= SIM_GPIOS) {
+        return;
+    }
+    if (enabled) {
+        pins[gpio].irq_mask |= event_mask;
+    } else {
+        pins[gpio].irq_mask &= ~event_mask;
+    }
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled, gpio_irq_callback_t callback) {
+    gpio_set_irq_enabled(gpio, event_mask, enabled);
+    gpio_set_irq_callback(callback);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+// pwm, the LEDs are only remembered
+
+uint pwm_gpio_to_slice_num(uint gpio) {
+    return (gpio >> 1) & 7;
+}
+
+pwm_config pwm_get_default_config(void) {
+    pwm_config c = { .clkdiv = 1.0f, .wrap = 0xFFFF };
+    return c;
+}
+
+void pwm_config_set_wrap(pwm_config *c, uint16_t wrap) {
+    c->wrap = wrap;
+}
+
+void pwm_config_set_clkdiv(pwm_config *c, float div) {
+    c->clkdiv = div;
+}
+
+void pwm_init(uint slice_num, pwm_config *c, bool start) {
+}
+
+void pwm_set_gpio_level(uint gpio, uint16_t level) {
+    if (gpio < SIM_GPIOS) {
+        pins[gpio].pwm_level = level;
+    }
+}
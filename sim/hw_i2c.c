@@ -0,0 +1,106 @@
+// hw_i2c.c
+// i2c0 with a 24LC256 on it. every transfer holds the caller for its time on the bus,
+// a page write starts the internal write cycle at the stop and the chip NACKs its
+// address until that's over, which is what the firmware's ack polling waits out
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/i2c.h"
+#include "config.h"
+#include "sim.h"
+#include "hw.h"
+
+i2c_inst_t i2c0_inst;
+i2c_inst_t i2c1_inst;
+
+static uint8_t memory[EEPROM_SIZE];
+static bool memory_ready = false;
+static uint16_t pointer = 0;        // the chip's address counter
+static uint64_t busy_until = 0;     // write cycle in progress until then
+static sim_i2c_stats_t stats;
+
+uint8_t *eeprom_model_memory(void) {
+    if (!memory_ready) {
+        memset(memory, 0xFF, sizeof(memory)); // blank from the factory
+        memory_ready = true;
+    }
+    return memory;
+}
+
+sim_i2c_stats_t i2c_model_get_stats(void) {
+    return stats;
+}
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate) {
+    i2c->baudrate = baudrate;
+    eeprom_model_memory();
+    return baudrate;
+}
+
+/**
+ hold the calling core for bytes on the bus, 9 clocks each with the ack, plus start and stop
+ */
+static void bus_time(i2c_inst_t *i2c, size_t bytes) {
+    uint baud = i2c->baudrate > 0 ? i2c->baudrate : 100000;
+    uint64_t us = ((uint64_t)bytes * 9 + 2) * 1000000 / baud;
+
+    stats.bytes += bytes;
+    stats.transfers++;
+    sim_block(sim_now_us() + us, SIM_BLOCK_I2C);
+}
+
+static bool addressed(i2c_inst_t *i2c, uint8_t addr) {
+    if (i2c != i2c0 || addr != EEPROM_ADDR || sim_now_us() < busy_until) {
+        stats.nacks++;
+        bus_time(i2c, 1);
+        return false;
+    }
+    return true;
+}
+
+int i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint timeout_us) {
+    if (!addressed(i2c, addr)) {
+        return PICO_ERROR_GENERIC;
+    }
+    bus_time(i2c, 1 + len);
+
+    if (len >= 2) {
+        pointer = ((src[0] << 8) | src[1]) % EEPROM_SIZE;
+    }
+    if (len > 2) {
+        // the counter wraps inside the page, like the chip
+        uint16_t page = pointer - pointer % EEPROM_PAGE_SIZE;
+        for (size_t i = 2; i < len; i++) {
+            memory[pointer] = src[i];
+            pointer = page + (pointer + 1) % EEPROM_PAGE_SIZE;
+        }
+        stats.bytes_written += len - 2;
+    }
+
+    if (len > 2 && !nostop) {
+        stats.write_cycles++;
+        busy_until = sim_now_us() + (uint64_t)sim_rand_range(SIM_EEPROM_WRITE_MIN_US, SIM_EEPROM_WRITE_MAX_US);
+    }
+    return (int)len;
+}
+
+int i2c_read_timeout_us(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint timeout_us) {
+    if (!addressed(i2c, addr)) {
+        return PICO_ERROR_GENERIC;
+    }
+    bus_time(i2c, 1 + len);
+
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = memory[pointer];
+        pointer = (pointer + 1) % EEPROM_SIZE;
+    }
+    return (int)len;
+}
+
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop) {
+    return i2c_write_timeout_us(i2c, addr, src, len, nostop, 0);
+}
+
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop) {
+    return i2c_read_timeout_us(i2c, addr, dst, len, nostop, 0);
+}
@@ -0,0 +1,116 @@
+// hw_uart.c
+// uart1 to the modem with 32 byte fifos both ways. tx drains at the baud rate and every
+// byte reaches the modem once it's fully on the wire, rx bytes land one at a time and
+// raise UART1_IRQ while the rx interrupt is on. uart0 (stdio) isn't modelled
+
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "hardware/irq.h"
+#include "sim.h"
+#include "hw.h"
+
+struct uart_inst {
+    uint baudrate;
+    bool rx_irq;
+    uint64_t tx_done_us;            // when the last queued byte is out
+    uint8_t rx[SIM_UART_FIFO];
+    uint32_t rx_head;
+    uint32_t rx_tail;
+};
+
+uart_inst_t uart0_inst;
+uart_inst_t uart1_inst;
+
+static sim_uart_stats_t stats;
+
+sim_uart_stats_t *uart_model_stats(void) {
+    return &stats;
+}
+
+uint64_t uart_model_char_us(void) {
+    uint baud = uart1->baudrate > 0 ? uart1->baudrate : 9600;
+    return 10 * 1000000ull / baud; // start, 8 data, stop
+}
+
+uint uart_init(uart_inst_t *uart, uint baudrate) {
+    uart->baudrate = baudrate;
+    uart->tx_done_us = 0;
+    uart->rx_head = uart->rx_tail = 0;
+    if (uart == uart1) {
+        modem_model_init();
+    }
+    return baudrate;
+}
+
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data) {
+    uart->rx_irq = rx_has_data;
+}
+
+static uint32_t tx_queued(uart_inst_t *uart) {
+    uint64_t now = sim_now_us();
+    if (uart->tx_done_us <= now) {
+        return 0;
+    }
+    uint64_t char_us = uart_model_char_us();
+    return (uint32_t)((uart->tx_done_us - now + char_us - 1) / char_us);
+}
+
+bool uart_is_writable(uart_inst_t *uart) {
+    sim_clock_read(); // a status register poll
+    return uart != uart1 || tx_queued(uart) < SIM_UART_FIFO;
+}
+
+bool uart_is_readable(uart_inst_t *uart) {
+    sim_clock_read();
+    return uart->rx_head != uart->rx_tail;
+}
+
+/**
+ waits for room in the fifo like the SDK does
+ */
+void uart_putc_raw(uart_inst_t *uart, char c) {
+    if (uart != uart1) {
+        return;
+    }
+
+    uint64_t char_us = uart_model_char_us();
+    while (tx_queued(uart) >= SIM_UART_FIFO) {
+        sim_block(uart->tx_done_us - (SIM_UART_FIFO - 1) * char_us, SIM_BLOCK_UART);
+    }
+
+    uint64_t start = uart->tx_done_us > sim_now_us() ? uart->tx_done_us : sim_now_us();
+    uart->tx_done_us = start + char_us;
+    stats.tx_bytes++;
+    modem_model_byte((uint8_t)c, uart->tx_done_us);
+}
+
+char uart_getc(uart_inst_t *uart) {
+    if (uart->rx_head == uart->rx_tail) {
+        return 0; // nothing there, the firmware always checks first
+    }
+    return (char)uart->rx[uart->rx_tail++ % SIM_UART_FIFO];
+}
+
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uart_putc_raw(uart, (char)src[i]);
+    }
+}
+
+/**
+ a byte from the modem has fully arrived
+ */
+void uart_model_receive(uint8_t c) {
+    uart_inst_t *uart = uart1;
+
+    stats.rx_bytes++;
+    if (uart->rx_head - uart->rx_tail >= SIM_UART_FIFO) {
+        stats.rx_overruns++;
+        return;
+    }
+    uart->rx[uart->rx_head++ % SIM_UART_FIFO] = c;
+
+    if (uart->rx_irq) {
+        sim_irq_raise(UART1_IRQ);
+    }
+}
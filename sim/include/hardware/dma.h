@@ -0,0 +1,47 @@
+// hardware/dma.h for the host simulation, just enough for ADC ping-pong blocks
+
+#ifndef SIM_HARDWARE_DMA_H
+#define SIM_HARDWARE_DMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/platform.h"
+#include "hardware/irq.h"
+
+#define NUM_DMA_CHANNELS 12
+#define DREQ_ADC 36
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2
+};
+
+typedef struct {
+    enum dma_channel_transfer_size size;
+    bool read_increment;
+    bool write_increment;
+    uint dreq;
+    uint chain_to;
+} dma_channel_config;
+
+typedef struct {
+    volatile uint32_t ints0;    // write 1 to clear on the chip, see hw_adc.c
+} dma_hw_t;
+
+extern dma_hw_t *dma_hw;
+
+int dma_claim_unused_channel(bool required);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger);
+void dma_channel_set_irq0_enabled(uint channel, bool enabled);
+void dma_channel_start(uint channel);
+
+#endif //SIM_HARDWARE_DMA_H
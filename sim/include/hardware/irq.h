@@ -0,0 +1,23 @@
+// hardware/irq.h for the host simulation
+
+#ifndef SIM_HARDWARE_IRQ_H
+#define SIM_HARDWARE_IRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/platform.h"
+
+#define TIMER_IRQ_0     0
+#define DMA_IRQ_0       11
+#define DMA_IRQ_1       12
+#define IO_IRQ_BANK0    13
+#define UART0_IRQ       20
+#define UART1_IRQ       21
+
+typedef void (*irq_handler_t)(void);
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+void irq_set_priority(uint num, uint8_t priority);
+
+#endif //SIM_HARDWARE_IRQ_H
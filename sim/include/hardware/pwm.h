@@ -0,0 +1,22 @@
+// hardware/pwm.h for the host simulation, levels are only remembered
+
+#ifndef SIM_HARDWARE_PWM_H
+#define SIM_HARDWARE_PWM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/platform.h"
+
+typedef struct {
+    float clkdiv;
+    uint16_t wrap;
+} pwm_config;
+
+uint pwm_gpio_to_slice_num(uint gpio);
+pwm_config pwm_get_default_config(void);
+void pwm_config_set_wrap(pwm_config *c, uint16_t wrap);
+void pwm_config_set_clkdiv(pwm_config *c, float div);
+void pwm_init(uint slice_num, pwm_config *c, bool start);
+void pwm_set_gpio_level(uint gpio, uint16_t level);
+
+#endif //SIM_HARDWARE_PWM_H
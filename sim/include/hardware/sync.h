@@ -0,0 +1,19 @@
+// hardware/sync.h for the host simulation. masking is per core like PRIMASK, irqs raised
+// while it's set wait until restore_interrupts()
+
+#ifndef SIM_HARDWARE_SYNC_H
+#define SIM_HARDWARE_SYNC_H
+
+#include <stdint.h>
+
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
+
+// cores only switch where they block, so there's nothing to order
+static inline void __dmb(void) {}
+
+void __wfi(void);
+void __wfe(void);
+void __sev(void);
+
+#endif //SIM_HARDWARE_SYNC_H
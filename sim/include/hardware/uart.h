@@ -0,0 +1,27 @@
+// hardware/uart.h for the host simulation, the AT modem model sits on uart1
+
+#ifndef SIM_HARDWARE_UART_H
+#define SIM_HARDWARE_UART_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "pico/platform.h"
+
+typedef struct uart_inst uart_inst_t;
+
+extern uart_inst_t uart0_inst;
+extern uart_inst_t uart1_inst;
+
+#define uart0 (&uart0_inst)
+#define uart1 (&uart1_inst)
+
+uint uart_init(uart_inst_t *uart, uint baudrate);
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data);
+bool uart_is_writable(uart_inst_t *uart);
+bool uart_is_readable(uart_inst_t *uart);
+void uart_putc_raw(uart_inst_t *uart, char c);
+char uart_getc(uart_inst_t *uart);
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len);
+
+#endif //SIM_HARDWARE_UART_H
@@ -0,0 +1,8 @@
+// pico/multicore.h for the host simulation, core 1 is a second cooperative context
+
+#ifndef SIM_PICO_MULTICORE_H
+#define SIM_PICO_MULTICORE_H
+
+void multicore_launch_core1(void (*entry)(void));
+
+#endif //SIM_PICO_MULTICORE_H
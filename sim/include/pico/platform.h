@@ -0,0 +1,12 @@
+// pico/platform.h for the host simulation
+
+#ifndef SIM_PICO_PLATFORM_H
+#define SIM_PICO_PLATFORM_H
+
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+uint get_core_num(void);
+
+#endif //SIM_PICO_PLATFORM_H
@@ -0,0 +1,10 @@
+// pico/rand.h for the host simulation, the same repeatable stream the models use
+
+#ifndef SIM_PICO_RAND_H
+#define SIM_PICO_RAND_H
+
+#include <stdint.h>
+
+uint32_t get_rand_32(void);
+
+#endif //SIM_PICO_RAND_H
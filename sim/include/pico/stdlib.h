@@ -0,0 +1,22 @@
+// pico/stdlib.h for the host simulation, stdio is the host's, uart0 isn't modelled
+
+#ifndef SIM_PICO_STDLIB_H
+#define SIM_PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "pico/platform.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+#include "hardware/uart.h"
+#include "hardware/sync.h"
+
+#define PICO_OK              0
+#define PICO_ERROR_GENERIC  -1
+#define PICO_ERROR_TIMEOUT  -2
+
+bool stdio_init_all(void);
+void tight_loop_contents(void);
+
+#endif //SIM_PICO_STDLIB_H
@@ -0,0 +1,251 @@
+// lora_bench.c
+// runs the firmware's LoRaWAN code (project/lorawan.c) against the modem model and
+// measures what its timeouts were guessed for: command round trips, time to join from
+// scratch and on the cached session, and how long an uplink takes from
+// lorawan_send_event() to sent. with a modem script the modem gets slow, busy, lossy
+// or noisy the way a real one does
+//
+// usage: lora_bench [--runs N] [--seed N] [--modem FILE] [--verbose]
+//   --runs     measurements per phase (default 200)
+//   --modem    modem script, see sim/scripts/
+//   --verbose  keep the firmware's own output
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "pico/stdlib.h"
+#include "config.h"
+#include "lorawan.h"
+#include "sim.h"
+#include "hw.h"
+
+#define BENCH_DEFAULT_RUNS  200
+#define BENCH_RUN_LIMIT_US  60000000ull   // simulated time per measurement, at most
+
+typedef struct {
+    const char *name;
+    uint64_t *us;               // successful ones
+    int ok;
+    int failed;
+    uint64_t limit_us;          // what the firmware waits at most
+} bench_phase_t;
+
+static const struct {
+    const char *command;
+    const char *outcome;
+} commands[] = {
+    { LORA_TEST, LORA_TEST_OUTCOME },
+    { LORAWAN_MODE, LORAWAN_MODE_OUTCOME },
+    { LORAWAN_KEY, LORAWAN_KEY_OUTCOME },
+    { LORAWAN_CLASS, LORAWAN_CLASS_OUTCOME },
+    { LORAWAN_PORT, LORAWAN_PORT_OUTCOME },
+};
+
+static int runs = BENCH_DEFAULT_RUNS;
+static bench_phase_t rtt = { "command round trip", NULL, 0, 0, LORAWAN_TIMEOUT_MS * 1000ull };
+static bench_phase_t join = { "join (probe, config, join)", NULL, 0, 0,
+                              (5 * LORAWAN_TIMEOUT_MS + LORAWAN_JOIN_TIMEOUT_MS) * 1000ull };
+static bench_phase_t warm = { "join on the cached session", NULL, 0, 0,
+                              (LORAWAN_TIMEOUT_MS + LORAWAN_JOIN_TIMEOUT_MS) * 1000ull };
+static bench_phase_t uplink = { "uplink completion", NULL, 0, 0,
+                                (LORAWAN_EVENT_COALESCE_MS + LORAWAN_TIMEOUT_MS + LORAWAN_MSG_DONE_TIMEOUT_MS) * 1000ull };
+static bool done = false;
+
+static void record(bench_phase_t *p, bool ok, uint64_t us) {
+    if (ok) {
+        p->us[p->ok++] = us;
+    } else {
+        p->failed++;
+    }
+}
+
+static void bench_commands(void) {
+    char response[STRLEN];
+
+    for (int i = 0; i < runs; i++) {
+        int c = i % (int)(sizeof(commands) / sizeof(commands[0]));
+        uint64_t t0 = time_us_64();
+        bool ok = lorawan_send_command(commands[c].command, response, commands[c].outcome);
+        record(&rtt, ok, time_us_64() - t0);
+    }
+}
+
+/**
+ bring the link up from scratch or on the session, true if it came up on the first try
+ */
+static bool link_up_once(bool keep_session) {
+    uint32_t failures = lorawan_get_link_stats().failures;
+
+    lorawan_link_restart(keep_session);
+    while (!lorawan_connected && lorawan_get_link_stats().failures == failures) {
+        lorawan_core1_step(); // core 1's loop, on this core
+    }
+    return lorawan_connected;
+}
+
+static void bench_join(void) {
+    for (int i = 0; i < runs; i++) {
+        modem_model_leave(); // every run is a fresh join
+        uint64_t t0 = time_us_64();
+        bool ok = link_up_once(false);
+        record(&join, ok, time_us_64() - t0);
+    }
+
+    // a reboot with the modem still joined, unless the last join failed
+    for (int i = 0; i < runs; i++) {
+        uint64_t t0 = time_us_64();
+        bool ok = link_up_once(true);
+        record(&warm, ok, time_us_64() - t0);
+    }
+}
+
+static void bench_uplinks(void) {
+    // the link backs off and tries again by itself if the join phase ended on a failure
+    while (!lorawan_connected) {
+        lorawan_core1_step(); // core 1's loop, on this core
+    }
+
+    for (int i = 0; i < runs; i++) {
+        uint64_t t0 = time_us_64();
+        int id = lorawan_send_event(UPLINK_EV_PILL_DETECTED, i % MAX_PILLS);
+        lorawan_msg_status_t status = lorawan_message_status(id);
+
+        while (status == LORAWAN_MSG_QUEUED || status == LORAWAN_MSG_SENDING) {
+            lorawan_core1_step(); // core 1's loop, on this core
+            status = lorawan_message_status(id);
+        }
+        record(&uplink, status == LORAWAN_MSG_SENT, time_us_64() - t0);
+    }
+}
+
+static void bench_main(void) {
+    init_lorawan();
+    bench_commands();
+    bench_join();
+    bench_uplinks();
+    done = true;
+}
+
+static bool bench_done(void) {
+    return done;
+}
+
+static int compare_us(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ nearest rank, p in percent, sorted input
+ */
+static double percentile_ms(const uint64_t *us, int n, int p) {
+    int rank = (p * n + 99) / 100;
+    return us[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+static void report_phase(bench_phase_t *p) {
+    printf("%-26s %5d %6d", p->name, p->ok, p->failed);
+    if (p->ok > 0) {
+        qsort(p->us, p->ok, sizeof(p->us[0]), compare_us);
+        printf(" %9.1f %9.1f %9.1f %9.1f", percentile_ms(p->us, p->ok, 50), percentile_ms(p->us, p->ok, 90),
+               percentile_ms(p->us, p->ok, 99), p->us[p->ok - 1] / 1000.0);
+    } else {
+        printf(" %9s %9s %9s %9s", "-", "-", "-", "-");
+    }
+    printf(" %9.1f\n", p->limit_us / 1000.0);
+}
+
+static void report(const char *script, uint32_t seed, uint64_t end_us, double host_s) {
+    sim_uart_stats_t *us = uart_model_stats();
+
+    printf("\n--- lora bench: %d runs per phase, seed %u, modem %s ---\n", runs, seed,
+           script != NULL ? script : "well behaved");
+    printf("%-26s %5s %6s %9s %9s %9s %9s %9s\n", "ms", "ok", "failed", "p50", "p90", "p99", "max", "limit");
+    report_phase(&rtt);
+    report_phase(&join);
+    report_phase(&warm);
+    report_phase(&uplink);
+    lorawan_link_stats_t ls = lorawan_get_link_stats();
+    printf("uplink completion includes the %d ms coalesce hold, and rejoining when the modem lost the session\n",
+           LORAWAN_EVENT_COALESCE_MS);
+    printf("link             %u tries, %u failed, %u joins, %u lost\n", ls.attempts, ls.failures, ls.joins, ls.losses);
+    printf("modem            %u commands: %u busy, %u errors, %u lost, %u garbage lines, %u joins failed, %u uplinks without Done\n",
+           us->commands, us->busy, us->errors, us->silent, us->garbage, us->join_failures, us->uplink_failures);
+    printf("simulated time   %.1f s in %.3f s on the host\n", end_us / 1e6, host_s);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [--runs N] [--seed N] [--modem FILE] [--verbose]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t seed = 1;
+    const char *script = NULL;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--runs") == 0 && has_value) {
+            runs = atoi(argv[++i]);
+            if (runs < 1) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--modem") == 0 && has_value) {
+            script = argv[++i];
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    sim_seed(seed);
+    if (script != NULL && !modem_model_script(script)) {
+        return 2;
+    }
+
+    rtt.us = calloc(runs, sizeof(uint64_t));
+    join.us = calloc(runs, sizeof(uint64_t));
+    warm.us = calloc(runs, sizeof(uint64_t));
+    uplink.us = calloc(runs, sizeof(uint64_t));
+    if (rtt.us == NULL || join.us == NULL || warm.us == NULL || uplink.us == NULL) {
+        fprintf(stderr, "lora_bench: out of memory\n");
+        return 1;
+    }
+
+    int saved_stdout = -1;
+    if (!verbose) {
+        fflush(stdout);
+        saved_stdout = dup(STDOUT_FILENO);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    sim_launch_core(0, bench_main);
+    uint64_t end_us = sim_run(4ull * runs * BENCH_RUN_LIMIT_US, bench_done);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (!verbose) {
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+
+    if (!done) {
+        fprintf(stderr, "lora_bench: ran out of simulated time\n");
+    }
+    report(script, seed, end_us, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    return done ? 0 : 1;
+}
@@ -0,0 +1,207 @@
+// lora_test.c
+// checks for the uplink path: the frame codec (project/uplink.c) on its own, then the
+// firmware's LoRaWAN code (project/lorawan.c) against the modem model. an event goes in
+// with lorawan_send_event(), the frame the modem got is decoded and compared, and a modem
+// that forgot the session ("Please join network first") gets the frame again after the
+// rejoin. run by ctest, exits 1 if anything failed
+//
+// usage: lora_test [--seed N] [--verbose]
+//   --verbose  keep the firmware's own output
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "pico/stdlib.h"
+#include "config.h"
+#include "lorawan.h"
+#include "sim.h"
+#include "hw.h"
+
+#define TEST_LIMIT_US   600000000ull  // simulated time for the whole run, at most
+
+static int failures = 0;
+static bool done = false;
+
+static void check(bool ok, const char *what) {
+    fprintf(stderr, "%s  %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+static bool same_event(const uplink_event_t *a, const uplink_event_t *b) {
+    return a->code == b->code && a->flags == b->flags && a->pill == b->pill && a->timestamp_ms == b->timestamp_ms;
+}
+
+static void test_codec(void) {
+    uplink_event_t in[UPLINK_MAX_EVENTS + 1];
+    uplink_event_t out[UPLINK_MAX_EVENTS];
+    uint8_t frame[UPLINK_MAX_PAYLOAD];
+    uint32_t now = 8000000;
+
+    // ages come back in whole 100 ms units, so the test events are made that way
+    for (int i = 0; i < UPLINK_MAX_EVENTS + 1; i++) {
+        in[i] = (uplink_event_t){
+            .code = (uint8_t)(i % UPLINK_EV_COUNT),
+            .flags = (uint8_t)(i & 0x0F),
+            .pill = i % 3 == 0 ? UPLINK_NO_PILL : (uint8_t)(i % MAX_PILLS),
+            .timestamp_ms = now - (uint32_t)i * 1300,
+        };
+    }
+
+    size_t len = uplink_encode(in, 3, now, frame, sizeof(frame));
+    int count = uplink_decode(frame, len, out, UPLINK_MAX_EVENTS);
+    bool same = count == 3;
+    for (int i = 0; i < 3 && same; i++) {
+        uplink_event_t expect = in[i];
+        expect.timestamp_ms = now - in[i].timestamp_ms; // decoded as the age
+        same = same_event(&expect, &out[i]);
+    }
+    check(len == UPLINK_HEADER_SIZE + 3 * UPLINK_EVENT_SIZE && same, "codec: three events round trip");
+
+    len = uplink_encode(in, UPLINK_MAX_EVENTS + 1, now, frame, sizeof(frame));
+    count = uplink_decode(frame, len, out, UPLINK_MAX_EVENTS);
+    check(len == UPLINK_MAX_PAYLOAD && count == UPLINK_MAX_EVENTS &&
+          out[UPLINK_MAX_EVENTS - 1].code == in[UPLINK_MAX_EVENTS - 1].code,
+          "codec: a full frame holds UPLINK_MAX_EVENTS, the rest is cut");
+
+    check(uplink_encode(in, 2, now, frame, UPLINK_HEADER_SIZE + UPLINK_EVENT_SIZE) == 0,
+          "codec: encode refuses a buffer that is too small");
+
+    uplink_event_t old = { .code = UPLINK_EV_BOOT, .pill = UPLINK_NO_PILL, .timestamp_ms = 0 };
+    len = uplink_encode(&old, 1, 0xFFFFFFF0u, frame, sizeof(frame));
+    count = uplink_decode(frame, len, out, UPLINK_MAX_EVENTS);
+    check(count == 1 && out[0].timestamp_ms == 0xFFFFu * UPLINK_AGE_UNIT_MS, "codec: an old event's age saturates");
+
+    len = uplink_encode(in, 2, now, frame, sizeof(frame));
+    check(uplink_decode(frame, 0, out, UPLINK_MAX_EVENTS) == -1, "codec: empty frame rejected");
+    check(uplink_decode(frame, len - 1, out, UPLINK_MAX_EVENTS) == -1, "codec: short frame rejected");
+    check(uplink_decode(frame, len, out, 1) == -1, "codec: more events than the caller has room for rejected");
+    frame[0] = (uint8_t)(((UPLINK_FORMAT_VERSION + 1) << 4) | 2);
+    check(uplink_decode(frame, len, out, UPLINK_MAX_EVENTS) == -1, "codec: unknown format version rejected");
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/**
+ decode the last uplink the modem took, -1 if it isn't a valid frame
+ */
+static int last_uplink_events(uplink_event_t *events) {
+    const char *hex = modem_model_last_uplink();
+    uint8_t frame[UPLINK_MAX_PAYLOAD];
+    size_t len = 0;
+
+    for (; hex[0] != '\0'; hex += 2) {
+        int hi = hex_value(hex[0]);
+        int lo = hex_value(hex[1]);
+        if (hi < 0 || lo < 0 || len >= sizeof(frame)) {
+            return -1;
+        }
+        frame[len++] = (uint8_t)((hi << 4) | lo);
+    }
+    return uplink_decode(frame, len, events, UPLINK_MAX_EVENTS);
+}
+
+/**
+ core 1's loop on this core until the event is out, its final status
+ */
+static lorawan_msg_status_t wait_sent(int id) {
+    lorawan_msg_status_t status = lorawan_message_status(id);
+
+    while (status == LORAWAN_MSG_QUEUED || status == LORAWAN_MSG_SENDING) {
+        lorawan_core1_step();
+        status = lorawan_message_status(id);
+    }
+    return status;
+}
+
+static void test_exchange(void) {
+    uplink_event_t events[UPLINK_MAX_EVENTS];
+    sim_uart_stats_t *us = uart_model_stats();
+
+    init_lorawan();
+    while (!lorawan_connected) {
+        lorawan_core1_step(); // core 1's loop, on this core
+    }
+    check(us->joined && lorawan_get_link_stats().joins == 1, "at: link up, the modem joined");
+
+    calibrated = true;
+    eeprom_initialized = true;
+    int id = lorawan_send_event(UPLINK_EV_PILL_DETECTED, 2);
+    check(wait_sent(id) == LORAWAN_MSG_SENT && us->uplinks == 1, "at: event sent with AT+MSGHEX");
+    int count = last_uplink_events(events);
+    check(count == 1 && events[0].code == UPLINK_EV_PILL_DETECTED && events[0].pill == 2 &&
+          events[0].flags == (UPLINK_FLAG_CALIBRATED | UPLINK_FLAG_EEPROM_OK),
+          "at: the modem got the event in the frame");
+
+    // the network dropped the session, the modem answers the next uplink with
+    // Please join network first and the firmware has to join and send the frame again
+    modem_model_leave();
+    uint32_t commands = us->commands;
+    id = lorawan_send_event(UPLINK_EV_PILL_MISSED, 3);
+    lorawan_msg_status_t status = wait_sent(id);
+    lorawan_link_stats_t ls = lorawan_get_link_stats();
+    check(status == LORAWAN_MSG_SENT && ls.losses == 1 && ls.joins == 2 && us->joined,
+          "at: not joined, the link went down and joined again");
+    count = last_uplink_events(events);
+    check(us->uplinks == 2 && us->commands > commands + 2 && count == 1 &&
+          events[0].code == UPLINK_EV_PILL_MISSED && events[0].pill == 3,
+          "at: the refused frame went out after the rejoin");
+}
+
+static void test_main(void) {
+    test_codec();
+    test_exchange();
+    done = true;
+}
+
+static bool test_done(void) {
+    return done;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [--seed N] [--verbose]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t seed = 1;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    sim_seed(seed);
+
+    // the results go to stderr, the firmware's printf to stdout
+    if (!verbose) {
+        fflush(stdout);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+
+    sim_launch_core(0, test_main);
+    sim_run(TEST_LIMIT_US, test_done);
+
+    if (!done) {
+        fprintf(stderr, "lora_test: ran out of simulated time\n");
+        return 1;
+    }
+    fprintf(stderr, "%d failed\n", failures);
+    return failures > 0 ? 1 : 0;
+}
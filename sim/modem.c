@@ -0,0 +1,424 @@
+// modem.c
+// LoRa-E5 style AT modem on uart1. answers the configuration commands, joins after a
+// while, and takes AT+MSGHEX uplinks with the +MSGHEX: Start / Done lines the real one
+// sends. replies are queued as lines and go out a byte at a time at the baud rate
+//
+// out of the box every reply is on time and nothing fails. a script (modem_model_script)
+// changes that two ways:
+//   set <what> <values>      random timing and faults for every command from then on
+//   <command> <action> [ms]  what happens to the next command, steps are used in order
+// see sim/scripts/ for examples
+
+#include <stdio.h>
+#include <string.h>
+#include "sim.h"
+#include "hw.h"
+
+#define MODEM_LINE_MAX  600
+#define MODEM_TX_LINES  16
+#define MODEM_SCRIPT_MAX 64
+
+typedef struct {
+    uint64_t at_us;             // not before this
+    char text[96];
+} modem_line_t;
+
+// what a script step does to the command it matches
+typedef enum {
+    MODEM_OK,                   // answer normally, maybe late
+    MODEM_SILENT,               // the command is lost, no answer at all
+    MODEM_BUSY,                 // "+CMD: LoRaWAN modem is busy"
+    MODEM_ERROR,                // "+AT: ERROR(-1)"
+    MODEM_GARBAGE,              // a line of line noise first, then the normal answer
+    MODEM_FAIL,                 // join: Join failed, uplink: never gets its Done
+    MODEM_LEAVE,                // the network forgot us, answer normally
+    MODEM_ACTION_COUNT
+} modem_action_t;
+
+static const char *action_names[MODEM_ACTION_COUNT] = {
+    "ok", "silent", "busy", "error", "garbage", "fail", "leave"
+};
+
+typedef struct {
+    char command[24];           // up to the = or ?, "*" for any
+    modem_action_t action;
+    uint32_t delay_us;          // on top of the normal reply time
+} modem_step_t;
+
+// random behaviour, the defaults are the well behaved modem
+typedef struct {
+    uint32_t reply_min_us;      // command to first reply line
+    uint32_t reply_max_us;
+    uint32_t slow_pct;          // replies that take up to slow_max_us instead
+    uint32_t slow_max_us;
+    uint32_t join_min_us;       // AT+JOIN to the verdict
+    uint32_t join_max_us;
+    uint32_t tx_min_us;         // AT+MSGHEX to Done, both rx windows included
+    uint32_t tx_max_us;
+    uint32_t join_fail_pct;
+    uint32_t tx_fail_pct;
+    uint32_t busy_pct;
+    uint32_t silent_pct;
+    uint32_t garbage_pct;
+} modem_profile_t;
+
+static modem_profile_t profile = {
+    .reply_min_us = SIM_MODEM_REPLY_US,
+    .reply_max_us = SIM_MODEM_REPLY_US,
+    .join_min_us = SIM_MODEM_JOIN_US,
+    .join_max_us = SIM_MODEM_JOIN_US,
+    .tx_min_us = SIM_MODEM_TX_US,
+    .tx_max_us = SIM_MODEM_TX_US,
+};
+
+static modem_step_t script[MODEM_SCRIPT_MAX];
+static int script_len = 0;
+static int script_pos = 0;
+
+static char rx_line[MODEM_LINE_MAX];
+static size_t rx_len = 0;
+
+static modem_line_t tx_lines[MODEM_TX_LINES];
+static int tx_head = 0;         // next line to send
+static int tx_count = 0;
+static size_t tx_pos = 0;       // in the line being sent
+static int tx_event = 0;
+
+static uint64_t busy_until = 0; // join or uplink in progress
+static char last_uplink[MODEM_LINE_MAX]; // hex payload of the last AT+MSGHEX taken
+
+static void tx_next(void *arg);
+
+static void tx_schedule(void) {
+    if (tx_event != 0 || tx_count == 0) {
+        return;
+    }
+    uint64_t at = tx_lines[tx_head].at_us;
+    tx_event = sim_at((at > sim_now_us() ? at : sim_now_us()) + uart_model_char_us(), tx_next, NULL);
+}
+
+static void tx_next(void *arg) {
+    modem_line_t *line = &tx_lines[tx_head];
+
+    tx_event = 0;
+    uart_model_receive((uint8_t)line->text[tx_pos++]);
+
+    if (line->text[tx_pos] == '\0') {
+        tx_pos = 0;
+        tx_head = (tx_head + 1) % MODEM_TX_LINES;
+        tx_count--;
+        tx_schedule();
+    } else {
+        tx_event = sim_at(sim_now_us() + uart_model_char_us(), tx_next, NULL);
+    }
+}
+
+/**
+ queue a reply line, it starts no earlier than at_us and after whatever is queued already
+ */
+static void reply(uint64_t at_us, const char *text) {
+    if (tx_count >= MODEM_TX_LINES) {
+        fprintf(stderr, "sim: modem reply queue full, dropped \"%s\"\n", text);
+        return;
+    }
+
+    modem_line_t *line = &tx_lines[(tx_head + tx_count) % MODEM_TX_LINES];
+    line->at_us = at_us;
+    snprintf(line->text, sizeof(line->text), "%s\r\n", text);
+    tx_count++;
+    tx_schedule();
+}
+
+/**
+ a line of noise, what a modem that browned out or lost sync on the baud rate sends
+ */
+static void reply_garbage(uint64_t at_us) {
+    char text[48];
+    int len = sim_rand_range(4, (int)sizeof(text) - 1);
+
+    for (int i = 0; i < len; i++) {
+        int c;
+        do {
+            c = sim_rand_range(1, 255);
+        } while (c == '\n');
+        text[i] = (char)c;
+    }
+    text[len] = '\0';
+    reply(at_us, text);
+}
+
+static bool starts_with(const char *s, const char *prefix) {
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/**
+ true pct percent of the time, never touches the random sequence when pct is 0
+ */
+static bool chance(uint32_t pct) {
+    return pct > 0 && (uint32_t)sim_rand_range(0, 99) < pct;
+}
+
+static uint64_t reply_delay(void) {
+    if (chance(profile.slow_pct)) {
+        return (uint64_t)sim_rand_range((int32_t)profile.reply_max_us, (int32_t)profile.slow_max_us);
+    }
+    return (uint64_t)sim_rand_range((int32_t)profile.reply_min_us, (int32_t)profile.reply_max_us);
+}
+
+/**
+ the next script step if it's for this command, otherwise whatever the profile rolls
+ */
+static modem_action_t next_action(const char *cmd, uint32_t *delay_us, bool *scripted) {
+    *delay_us = 0;
+    *scripted = false;
+
+    if (script_pos < script_len) {
+        const modem_step_t *step = &script[script_pos];
+        size_t n = strcspn(cmd, "=?");
+        if (strcmp(step->command, "*") == 0 ||
+            (strlen(step->command) == n && strncmp(step->command, cmd, n) == 0)) {
+            script_pos++;
+            *delay_us = step->delay_us;
+            *scripted = true;
+            return step->action;
+        }
+    }
+
+    if (chance(profile.silent_pct)) {
+        return MODEM_SILENT;
+    }
+    if (chance(profile.garbage_pct)) {
+        return MODEM_GARBAGE;
+    }
+    if (strcmp(cmd, "AT") != 0 && chance(profile.busy_pct)) {
+        return MODEM_BUSY;
+    }
+    return MODEM_OK;
+}
+
+static void reply_busy(uint64_t at_us, const char *cmd) {
+    char text[96];
+    const char *name = strchr(cmd, '+');
+    size_t n = strcspn(name != NULL ? name + 1 : "AT", "=?");
+
+    snprintf(text, sizeof(text), "+%.*s: LoRaWAN modem is busy", (int)n, name != NULL ? name + 1 : "AT");
+    reply(at_us, text);
+}
+
+/**
+ a whole command line arrived at at_us
+ */
+static void command(const char *cmd, uint64_t at_us) {
+    sim_uart_stats_t *stats = uart_model_stats();
+    uint32_t extra_us;
+    bool scripted;
+    modem_action_t action = next_action(cmd, &extra_us, &scripted);
+    uint64_t t = at_us + reply_delay() + extra_us;
+    char text[96];
+
+    stats->commands++;
+
+    switch (action) {
+        case MODEM_SILENT:
+            stats->silent++;
+            return;
+        case MODEM_BUSY:
+            stats->busy++;
+            reply_busy(t, cmd);
+            return;
+        case MODEM_ERROR:
+            stats->errors++;
+            reply(t, "+AT: ERROR(-1)");
+            return;
+        case MODEM_GARBAGE:
+            stats->garbage++;
+            reply_garbage(t);
+            break;
+        case MODEM_LEAVE:
+            stats->joined = false;
+            break;
+        default:
+            break;
+    }
+
+    if (strcmp(cmd, "AT") == 0) {
+        reply(t, "+AT: OK");
+    } else if (at_us < busy_until) {
+        // anything but AT while a join or an uplink is on the air
+        stats->busy++;
+        reply_busy(t, cmd);
+    } else if (starts_with(cmd, "AT+MODE=")) {
+        snprintf(text, sizeof(text), "+MODE: %s", cmd + 8);
+        reply(t, text);
+    } else if (starts_with(cmd, "AT+KEY=APPKEY,\"")) {
+        snprintf(text, sizeof(text), "+KEY: APPKEY %.*s", (int)strcspn(cmd + 15, "\""), cmd + 15);
+        reply(t, text);
+    } else if (starts_with(cmd, "AT+CLASS=")) {
+        snprintf(text, sizeof(text), "+CLASS: %s", cmd + 9);
+        reply(t, text);
+    } else if (starts_with(cmd, "AT+PORT=")) {
+        snprintf(text, sizeof(text), "+PORT: %s", cmd + 8);
+        reply(t, text);
+    } else if (strcmp(cmd, "AT+JOIN") == 0) {
+        if (stats->joined) {
+            reply(t, "+JOIN: Joined already");
+            return;
+        }
+        bool fail = scripted ? action == MODEM_FAIL : chance(profile.join_fail_pct);
+        busy_until = at_us + (uint64_t)sim_rand_range((int32_t)profile.join_min_us, (int32_t)profile.join_max_us);
+        reply(t, "+JOIN: Start");
+        reply(t, "+JOIN: NORMAL");
+        if (fail) {
+            stats->join_failures++;
+            reply(busy_until, "+JOIN: Join failed");
+        } else {
+            reply(busy_until, "+JOIN: Network joined");
+            reply(busy_until, "+JOIN: NetID 000013 DevAddr 26:0B:5F:3A");
+            stats->joined = true;
+        }
+        reply(busy_until, "+JOIN: Done");
+    } else if (starts_with(cmd, "AT+MSGHEX=\"")) {
+        size_t hex = strcspn(cmd + 11, "\"");
+        if (!stats->joined) {
+            reply(t, "+MSGHEX: Please join network first");
+            return;
+        }
+        bool fail = scripted ? action == MODEM_FAIL : chance(profile.tx_fail_pct);
+        busy_until = at_us + (uint64_t)sim_rand_range((int32_t)profile.tx_min_us, (int32_t)profile.tx_max_us);
+        stats->uplinks++;
+        stats->uplink_bytes += hex / 2;
+        snprintf(last_uplink, sizeof(last_uplink), "%.*s", (int)hex, cmd + 11);
+        reply(t, "+MSGHEX: Start");
+        if (fail) {
+            stats->uplink_failures++;
+        } else {
+            reply(busy_until, "+MSGHEX: Done");
+        }
+    } else {
+        reply(t, "+AT: ERROR(-1)");
+    }
+}
+
+void modem_model_init(void) {
+    rx_len = 0;
+}
+
+/**
+ the network forgets the session, the next AT+JOIN really joins again
+ */
+void modem_model_leave(void) {
+    uart_model_stats()->joined = false;
+}
+
+static bool set_profile(const char *what, const long *v, int n) {
+    // name, values it takes, where they go (ms unless it's a percentage)
+    if (strcmp(what, "reply") == 0 && n == 2) {
+        profile.reply_min_us = (uint32_t)v[0] * 1000;
+        profile.reply_max_us = (uint32_t)v[1] * 1000;
+    } else if (strcmp(what, "slow") == 0 && n == 2) {
+        profile.slow_pct = (uint32_t)v[0];
+        profile.slow_max_us = (uint32_t)v[1] * 1000;
+    } else if (strcmp(what, "join") == 0 && n == 2) {
+        profile.join_min_us = (uint32_t)v[0] * 1000;
+        profile.join_max_us = (uint32_t)v[1] * 1000;
+    } else if (strcmp(what, "tx") == 0 && n == 2) {
+        profile.tx_min_us = (uint32_t)v[0] * 1000;
+        profile.tx_max_us = (uint32_t)v[1] * 1000;
+    } else if (strcmp(what, "join_fail") == 0 && n == 1) {
+        profile.join_fail_pct = (uint32_t)v[0];
+    } else if (strcmp(what, "tx_fail") == 0 && n == 1) {
+        profile.tx_fail_pct = (uint32_t)v[0];
+    } else if (strcmp(what, "busy") == 0 && n == 1) {
+        profile.busy_pct = (uint32_t)v[0];
+    } else if (strcmp(what, "silent") == 0 && n == 1) {
+        profile.silent_pct = (uint32_t)v[0];
+    } else if (strcmp(what, "garbage") == 0 && n == 1) {
+        profile.garbage_pct = (uint32_t)v[0];
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ load a modem script, false (and a message) if it doesn't parse
+ */
+/**
+ hex payload of the last uplink the modem put on the air, "" before the first
+ */
+const char *modem_model_last_uplink(void) {
+    return last_uplink;
+}
+
+bool modem_model_script(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[160];
+    int line_no = 0;
+
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char word[2][24];
+        long v[2];
+        line_no++;
+
+        char *hash = strchr(line, '#');
+        if (hash != NULL) {
+            *hash = '\0';
+        }
+        int n = sscanf(line, "%23s %23s %ld %ld", word[0], word[1], &v[0], &v[1]);
+        if (n <= 0) {
+            continue; // blank or a comment
+        }
+
+        bool ok = false;
+        if (strcmp(word[0], "set") == 0) {
+            ok = n >= 3 && set_profile(word[1], v, n - 2);
+        } else if (n >= 2 && n <= 3 && script_len < MODEM_SCRIPT_MAX) {
+            modem_step_t *step = &script[script_len];
+            for (int a = 0; a < MODEM_ACTION_COUNT; a++) {
+                if (strcmp(word[1], action_names[a]) == 0) {
+                    snprintf(step->command, sizeof(step->command), "%s", word[0]);
+                    step->action = (modem_action_t)a;
+                    step->delay_us = n == 3 ? (uint32_t)v[0] * 1000 : 0;
+                    script_len++;
+                    ok = true;
+                    break;
+                }
+            }
+        }
+
+        if (!ok) {
+            fprintf(stderr, "%s:%d: can't make sense of this line\n", path, line_no);
+            fclose(f);
+            return false;
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+/**
+ a byte from the pico, at_us is when its stop bit is done
+ */
+void modem_model_byte(uint8_t c, uint64_t at_us) {
+    if (c == '\r') {
+        return;
+    }
+    if (c != '\n') {
+        if (rx_len < MODEM_LINE_MAX - 1) {
+            rx_line[rx_len++] = (char)c;
+        }
+        return;
+    }
+
+    rx_line[rx_len] = '\0';
+    rx_len = 0;
+    if (rx_line[0] != '\0') {
+        command(rx_line, at_us);
+    }
+}
@@ -0,0 +1,482 @@
+// sim.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include "sim.h"
+
+typedef enum {
+    CORE_OFF,
+    CORE_READY,
+    CORE_WAITING,
+    CORE_DONE
+} core_state_t;
+
+typedef enum {
+    WAIT_BLOCK,     // only the deadline ends it
+    WAIT_WFI,       // an irq for this core, or the deadline
+    WAIT_WFE        // an irq, a sev, or the deadline
+} wait_kind_t;
+
+typedef struct {
+    uint32_t num;
+    sim_fn_t fn;
+    void *arg;
+} pending_irq_t;
+
+typedef struct {
+    core_state_t state;
+    ucontext_t ctx;
+    void *stack;
+    void (*entry)(void);
+    wait_kind_t wait;
+    sim_block_t why;
+    uint64_t wait_start;
+    uint64_t deadline;
+    bool woken;                 // by an irq or sev, not the deadline
+    bool event_flag;            // the wfe event register
+    uint32_t masked;            // PRIMASK
+    pending_irq_t pending[SIM_PENDING_MAX];
+    int pending_count;
+    uint32_t clock_reads;       // since the core last blocked
+} sim_core_t;
+
+typedef struct {
+    uint64_t at;
+    uint64_t seq;               // keeps events at the same time in the order they were added
+    sim_fn_t fn;
+    void *arg;
+    int id;
+} sim_event_t;
+
+static uint64_t now_us = 0;
+static sim_core_t cores[SIM_CORES];
+static int running = -1;        // core whose context we're on, -1 for the scheduler
+static ucontext_t sched_ctx;
+
+// min-heap on (at, seq)
+static sim_event_t heap[SIM_MAX_EVENTS];
+static int heap_count = 0;
+static uint64_t next_seq = 0;
+static int next_id = 1;
+
+// handlers nest, irq_core is the core the innermost one runs for
+static int irq_core = -1;
+static int irq_depth = 0;
+
+// the default alarm pool's irq is always there, on core 0
+static void (*irq_handlers[SIM_IRQ_COUNT])(void);
+static bool irq_enabled[SIM_IRQ_COUNT] = { [SIM_TIMER_IRQ] = true };
+static int irq_owner[SIM_IRQ_COUNT];
+
+static sim_stats_t stats;
+static uint32_t rand_state = 0x2545F491;
+
+static const char *block_names[SIM_BLOCK_COUNT] = {
+    "idle",
+    "sleep",
+    "i2c",
+    "uart",
+    "spin",
+};
+
+uint64_t sim_now_us(void) {
+    return now_us;
+}
+
+const sim_stats_t *sim_get_stats(void) {
+    return &stats;
+}
+
+const char *sim_block_name(sim_block_t why) {
+    return why < SIM_BLOCK_COUNT ? block_names[why] : "?";
+}
+
+static bool event_before(const sim_event_t *a, const sim_event_t *b) {
+    return a->at < b->at || (a->at == b->at && a->seq < b->seq);
+}
+
+static void heap_swap(int a, int b) {
+    sim_event_t t = heap[a];
+    heap[a] = heap[b];
+    heap[b] = t;
+}
+
+static void heap_up(int i) {
+    while (i > 0 && event_before(&heap[i], &heap[(i - 1) / 2])) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(int i) {
+    for (;;) {
+        int smallest = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        if (l < heap_count && event_before(&heap[l], &heap[smallest])) smallest = l;
+        if (r < heap_count && event_before(&heap[r], &heap[smallest])) smallest = r;
+        if (smallest == i) {
+            return;
+        }
+        heap_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+static void heap_remove(int i) {
+    heap[i] = heap[--heap_count];
+    if (i < heap_count) {
+        heap_up(i);
+        heap_down(i);
+    }
+}
+
+/**
+ run fn at at_us, or right away (after whatever is already due) if that's in the past
+ */
+int sim_at(uint64_t at_us, sim_fn_t fn, void *arg) {
+    if (heap_count >= SIM_MAX_EVENTS) {
+        fprintf(stderr, "sim: event queue full at %llu us\n", (unsigned long long)now_us);
+        exit(1);
+    }
+
+    int id = next_id;
+    next_id = next_id == INT32_MAX ? 1 : next_id + 1;
+
+    heap[heap_count] = (sim_event_t){
+        .at = at_us > now_us ? at_us : now_us,
+        .seq = next_seq++,
+        .fn = fn,
+        .arg = arg,
+        .id = id
+    };
+    heap_up(heap_count++);
+    return id;
+}
+
+bool sim_cancel(int id) {
+    for (int i = 0; i < heap_count; i++) {
+        if (heap[i].id == id) {
+            heap_remove(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void fire_due(void) {
+    while (heap_count > 0 && heap[0].at <= now_us) {
+        sim_event_t ev = heap[0];
+        heap_remove(0);
+        stats.events++;
+        ev.fn(ev.arg);
+    }
+}
+
+static void core_entry(int core) {
+    cores[core].entry();
+    cores[core].state = CORE_DONE; // uc_link takes us back to the scheduler
+}
+
+void sim_launch_core(int core, void (*entry)(void)) {
+    sim_core_t *c = &cores[core];
+
+    if (c->stack == NULL) {
+        c->stack = malloc(SIM_STACK_SIZE);
+        if (c->stack == NULL) {
+            fprintf(stderr, "sim: no memory for core %d's stack\n", core);
+            exit(1);
+        }
+    }
+
+    getcontext(&c->ctx);
+    c->ctx.uc_stack.ss_sp = c->stack;
+    c->ctx.uc_stack.ss_size = SIM_STACK_SIZE;
+    c->ctx.uc_link = &sched_ctx;
+    makecontext(&c->ctx, (void (*)(void))core_entry, 1, core);
+
+    c->entry = entry;
+    c->masked = 0;
+    c->pending_count = 0;
+    c->state = CORE_READY;
+}
+
+static void wake(int core, bool by_irq) {
+    sim_core_t *c = &cores[core];
+    stats.blocked_us[core][c->why] += now_us - c->wait_start;
+    c->woken = by_irq;
+    c->state = CORE_READY;
+}
+
+/**
+ park the running core until the scheduler wakes it
+ */
+static void core_wait(wait_kind_t kind, uint64_t deadline, sim_block_t why) {
+    sim_core_t *c = &cores[running];
+
+    c->state = CORE_WAITING;
+    c->wait = kind;
+    c->why = why;
+    c->deadline = deadline;
+    c->wait_start = now_us;
+    c->woken = false;
+    c->clock_reads = 0;
+
+    swapcontext(&c->ctx, &sched_ctx);
+}
+
+static void resume(int core) {
+    running = core;
+    stats.resumes[core]++;
+    swapcontext(&sched_ctx, &cores[core].ctx);
+    running = -1;
+}
+
+/**
+ run until stop() says so or the clock gets to limit_us, returns the time we stopped at
+ */
+uint64_t sim_run(uint64_t limit_us, bool (*stop)(void)) {
+    for (;;) {
+        fire_due();
+        if (stop != NULL && stop()) {
+            break;
+        }
+
+        bool ran = false;
+        for (int i = 0; i < SIM_CORES; i++) {
+            if (cores[i].state == CORE_READY) {
+                resume(i);
+                fire_due();
+                ran = true;
+            }
+        }
+        if (ran) {
+            continue;
+        }
+
+        // nobody can run, move the clock to whatever happens next
+        uint64_t next = heap_count > 0 ? heap[0].at : SIM_FOREVER;
+        for (int i = 0; i < SIM_CORES; i++) {
+            if (cores[i].state == CORE_WAITING && cores[i].deadline < next) {
+                next = cores[i].deadline;
+            }
+        }
+
+        if (next == SIM_FOREVER) {
+            fprintf(stderr, "sim: both cores asleep with nothing scheduled at %llu us\n", (unsigned long long)now_us);
+            break;
+        }
+        if (next > limit_us) {
+            now_us = limit_us;
+            break;
+        }
+
+        now_us = next;
+        for (int i = 0; i < SIM_CORES; i++) {
+            if (cores[i].state == CORE_WAITING && cores[i].deadline <= now_us) {
+                wake(i, false);
+            }
+        }
+    }
+
+    // whoever is still waiting has been blocked until now
+    for (int i = 0; i < SIM_CORES; i++) {
+        if (cores[i].state == CORE_WAITING) {
+            stats.blocked_us[i][cores[i].why] += now_us - cores[i].wait_start;
+            cores[i].wait_start = now_us;
+        }
+    }
+    return now_us;
+}
+
+int sim_core(void) {
+    if (irq_depth > 0) {
+        return irq_core;
+    }
+    return running >= 0 ? running : 0;
+}
+
+bool sim_in_irq(void) {
+    return irq_depth > 0;
+}
+
+// blocking only means something for a core's own code, handlers and models can't
+static bool can_block(void) {
+    return running >= 0 && irq_depth == 0;
+}
+
+void sim_block(uint64_t until_us, sim_block_t why) {
+    if (!can_block() || until_us <= now_us) {
+        return;
+    }
+    core_wait(WAIT_BLOCK, until_us, why);
+}
+
+/**
+ wfi (wfe = false) or wfe with a deadline. true if an irq or sev ended it
+ */
+bool sim_wait(uint64_t deadline_us, bool wfe) {
+    if (!can_block()) {
+        return true;
+    }
+
+    sim_core_t *c = &cores[running];
+    if (c->pending_count > 0) {
+        return true; // masked irq waiting, wfi doesn't sleep
+    }
+    if (wfe && c->event_flag) {
+        c->event_flag = false;
+        return true;
+    }
+    if (deadline_us <= now_us) {
+        return false;
+    }
+
+    core_wait(wfe ? WAIT_WFE : WAIT_WFI, deadline_us, SIM_BLOCK_IDLE);
+    if (wfe) {
+        c->event_flag = false;
+    }
+    return c->woken;
+}
+
+void sim_sev(void) {
+    for (int i = 0; i < SIM_CORES; i++) {
+        cores[i].event_flag = true;
+        if (cores[i].state == CORE_WAITING && cores[i].wait == WAIT_WFE) {
+            wake(i, true);
+        }
+    }
+}
+
+/**
+ every clock read lands here. code that keeps reading the clock without ever blocking is
+ busy waiting, so let time pass for it or it would spin forever at the same instant
+ */
+void sim_clock_read(void) {
+    if (!can_block()) {
+        return;
+    }
+
+    sim_core_t *c = &cores[running];
+    if (++c->clock_reads > SIM_SPIN_LIMIT) {
+        core_wait(WAIT_BLOCK, now_us + SIM_SPIN_STEP_US, SIM_BLOCK_SPIN);
+    }
+}
+
+void sim_irq_set_handler(uint32_t num, void (*handler)(void)) {
+    if (num < SIM_IRQ_COUNT) {
+        irq_handlers[num] = handler;
+    }
+}
+
+void sim_irq_set_enabled(uint32_t num, bool enabled) {
+    if (num < SIM_IRQ_COUNT) {
+        irq_enabled[num] = enabled;
+        if (enabled) {
+            irq_owner[num] = sim_core();
+        }
+    }
+}
+
+static void run_irq(int core, sim_fn_t fn, void *arg) {
+    int prev_core = irq_core;
+
+    irq_core = core;
+    irq_depth++;
+    stats.irqs[core]++;
+    fn(arg);
+    irq_depth--;
+    irq_core = prev_core;
+}
+
+static void call_handler(void *arg) {
+    uint32_t num = (uint32_t)(uintptr_t)arg;
+    if (irq_handlers[num] != NULL) {
+        irq_handlers[num]();
+    }
+}
+
+void sim_irq_raise(uint32_t num) {
+    sim_irq_call(num, call_handler, (void *)(uintptr_t)num);
+}
+
+/**
+ run fn as the handler of irq num on the core that owns it. held back while that core
+ has interrupts masked, either way a wfi/wfe on it ends
+ */
+void sim_irq_call(uint32_t num, sim_fn_t fn, void *arg) {
+    if (num >= SIM_IRQ_COUNT || !irq_enabled[num]) {
+        return;
+    }
+
+    int core = irq_owner[num];
+    sim_core_t *c = &cores[core];
+
+    if (c->masked) {
+        if (c->pending_count < SIM_PENDING_MAX) {
+            c->pending[c->pending_count++] = (pending_irq_t){ num, fn, arg };
+            stats.irqs_deferred++;
+        } else {
+            fprintf(stderr, "sim: core %d has too many masked irqs pending, dropped irq %u\n", core, num);
+        }
+    } else {
+        run_irq(core, fn, arg);
+    }
+
+    if (c->state == CORE_WAITING && c->wait != WAIT_BLOCK) {
+        wake(core, true);
+    }
+}
+
+uint32_t sim_irq_save(void) {
+    if (!can_block()) {
+        return 1; // handlers don't preempt each other anyway
+    }
+
+    sim_core_t *c = &cores[running];
+    uint32_t status = c->masked;
+    c->masked = 1;
+    return status;
+}
+
+void sim_irq_restore(uint32_t status) {
+    if (!can_block()) {
+        return;
+    }
+
+    int core = running;
+    sim_core_t *c = &cores[core];
+    c->masked = status;
+
+    // whatever was raised in the meantime runs now, in order
+    for (int i = 0; !c->masked && i < c->pending_count; i++) {
+        pending_irq_t p = c->pending[i];
+        run_irq(core, p.fn, p.arg);
+    }
+    if (!c->masked) {
+        c->pending_count = 0;
+    }
+}
+
+void sim_seed(uint32_t seed) {
+    rand_state = seed != 0 ? seed : 0x2545F491;
+}
+
+// xorshift32
+uint32_t sim_rand(void) {
+    uint32_t x = rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rand_state = x;
+    return x;
+}
+
+int32_t sim_rand_range(int32_t lo, int32_t hi) {
+    if (hi <= lo) {
+        return lo;
+    }
+    return lo + (int32_t)(sim_rand() % (uint32_t)(hi - lo + 1));
+}
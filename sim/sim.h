@@ -0,0 +1,75 @@
+// sim.h
+// host simulation core: a virtual clock, a queue of timed events, and the two RP2040 cores
+// as cooperative contexts. a core runs until it blocks (wfi, sleep, a bus transfer), time
+// only moves when neither core can run, so code takes no time and every wait is exact.
+// irq handlers run as soon as they're raised unless the target core has them masked
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_CORES           2
+#define SIM_STACK_SIZE      (256 * 1024)
+#define SIM_MAX_EVENTS      1024
+#define SIM_IRQ_COUNT       32
+#define SIM_PENDING_MAX     32      // irqs held back per core while it has them masked
+#define SIM_SPIN_LIMIT      1000    // clock reads without blocking before it counts as busy waiting
+#define SIM_SPIN_STEP_US    10      // how far a busy wait moves the clock per SIM_SPIN_LIMIT reads
+#define SIM_FOREVER         UINT64_MAX
+#define SIM_TIMER_IRQ       0       // the default alarm pool's, always enabled on core 0
+
+typedef void (*sim_fn_t)(void *arg);
+
+// why a core wasn't running, for the report
+typedef enum {
+    SIM_BLOCK_IDLE,     // wfi / wfe
+    SIM_BLOCK_SLEEP,    // sleep_until() and friends
+    SIM_BLOCK_I2C,      // eeprom bus transfers, ack polling included
+    SIM_BLOCK_UART,     // uart_write_blocking() waiting for fifo room
+    SIM_BLOCK_SPIN,     // polling the clock or a register without ever blocking
+    SIM_BLOCK_COUNT
+} sim_block_t;
+
+typedef struct {
+    uint64_t blocked_us[SIM_CORES][SIM_BLOCK_COUNT];
+    uint32_t irqs[SIM_CORES];       // handlers run
+    uint32_t irqs_deferred;         // raised while masked, ran at restore_interrupts()
+    uint32_t resumes[SIM_CORES];    // times the scheduler switched to the core
+    uint32_t events;                // timed events fired
+} sim_stats_t;
+
+// clock and scheduler
+uint64_t sim_now_us(void);
+int sim_at(uint64_t at_us, sim_fn_t fn, void *arg);
+bool sim_cancel(int id);
+void sim_launch_core(int core, void (*entry)(void));
+uint64_t sim_run(uint64_t limit_us, bool (*stop)(void));
+const sim_stats_t *sim_get_stats(void);
+const char *sim_block_name(sim_block_t why);
+
+// the calling core, or the one an irq handler is running for
+int sim_core(void);
+bool sim_in_irq(void);
+
+// waits, only the calling core stops, irqs keep being delivered
+void sim_block(uint64_t until_us, sim_block_t why);
+bool sim_wait(uint64_t deadline_us, bool wfe);
+void sim_sev(void);
+void sim_clock_read(void);
+
+// interrupts, an irq belongs to the core that enabled it
+void sim_irq_set_handler(uint32_t num, void (*handler)(void));
+void sim_irq_set_enabled(uint32_t num, bool enabled);
+void sim_irq_raise(uint32_t num);
+void sim_irq_call(uint32_t num, sim_fn_t fn, void *arg);
+uint32_t sim_irq_save(void);
+void sim_irq_restore(uint32_t status);
+
+// repeatable randomness for the models
+void sim_seed(uint32_t seed);
+uint32_t sim_rand(void);
+int32_t sim_rand_range(int32_t lo, int32_t hi);
+
+#endif //SIM_H
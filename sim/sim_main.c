@@ -0,0 +1,306 @@
+// sim_main.c
+// host simulation entry. boots the firmware on the simulated board, plays the operator
+// (calibrate, load the pills, start the sequence), stops a little after the last pill so
+// the uplinks get out, then reports where the time went
+//
+// usage: blink_sim [--seconds N] [--seed N] [--missing K]... [--state FILE] [--modem FILE] [--piezo FILE] [--quiet] [--trace]
+//   --seconds  stop after this much simulated time at the latest (default 600), fractions
+//              land a cut in the middle of a move
+//   --missing  leave compartment K (1..7) empty, the firmware should report a missed pill
+//   --state    EEPROM contents, carousel position and the modem's session are read from FILE if it exists and
+//              written back at the end, a second run then boots warm. cut the first one
+//              short with --seconds to test recovery
+//   --modem    modem script, see sim/scripts/
+//   --piezo    write every ADC sample the firmware gets to FILE, one per line, for tools/piezo_replay
+//   --quiet    only the report, not the firmware's own output
+//   --trace    dump the span trace as well, when the firmware was built with it
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "config.h"
+#include "trace.h"
+#include "sim.h"
+#include "hw.h"
+
+#define SIM_DEFAULT_SECONDS  600
+#define SIM_OPERATOR_TICK_US 100000     // how often the operator looks at the device
+#define SIM_FIRST_PRESS_US   500000
+#define SIM_PRESS_US         150000     // a normal button press
+#define SIM_RETRY_US         2000000    // press again if nothing happened by then
+#define SIM_DRAIN_US         15000000   // after the sequence ends, for the uplinks to go out
+#define SIM_STATE_MAGIC      0x50445332 // "PDS2"
+
+int firmware_main(void);
+
+typedef struct {
+    uint32_t magic;
+    sim_carousel_state_t wheel;
+    bool modem_joined;          // the modem stays powered through a pico reset
+    uint8_t eeprom[EEPROM_SIZE];
+} sim_state_file_t;
+
+// what the operator has done so far
+typedef struct {
+    bool loaded;                // pills are in
+    bool started;               // the sequence has run
+    uint64_t pressed_us;        // last press, 0 if none
+    uint64_t finished_us;       // sequence over (or failed), 0 while it isn't
+} sim_operator_t;
+
+static sim_operator_t op;
+static uint8_t missing = 0;
+
+static const char *state_names[] = { "WAIT_CAL", "IDLE", "FIRST_DELAY", "DISPENSE", "ERROR" };
+
+#define PIN_LEVEL(gpio, level) ((void *)(uintptr_t)((gpio) | ((level) << 8)))
+
+static void pin_event(void *arg) {
+    uint32_t v = (uint32_t)(uintptr_t)arg;
+    gpio_model_input(v & 0xFF, v >> 8);
+}
+
+/**
+ press a button for hold_us, the contacts bounce a little both ways
+ */
+static void press(uint32_t gpio, uint64_t hold_us) {
+    uint64_t t = sim_now_us();
+
+    sim_at(t, pin_event, PIN_LEVEL(gpio, 0));
+    sim_at(t + 300, pin_event, PIN_LEVEL(gpio, 1));
+    sim_at(t + 700, pin_event, PIN_LEVEL(gpio, 0));
+    sim_at(t + hold_us, pin_event, PIN_LEVEL(gpio, 1));
+    sim_at(t + hold_us + 400, pin_event, PIN_LEVEL(gpio, 0));
+    sim_at(t + hold_us + 900, pin_event, PIN_LEVEL(gpio, 1));
+    op.pressed_us = t;
+}
+
+static bool press_due(void) {
+    return op.pressed_us == 0 || sim_now_us() - op.pressed_us >= SIM_RETRY_US;
+}
+
+static void operator_tick(void *arg) {
+    if (op.finished_us == 0) {
+        switch (state) {
+            case S_WAIT_CAL:
+                if (op.started) {
+                    op.finished_us = sim_now_us();
+                } else if (op.pressed_us == 0 && sim_now_us() >= SIM_FIRST_PRESS_US) {
+                    press(CENTER_BUTTON, SIM_PRESS_US); // calibrating keeps us here, don't press again
+                }
+                break;
+
+            case S_IDLE:
+                // calibrated with an empty carousel, fill it and go
+                if (!op.loaded) {
+                    carousel_load_pills(missing);
+                    op.loaded = true;
+                }
+                if (press_due()) {
+                    press(LEFT_BUTTON, SIM_PRESS_US);
+                }
+                break;
+
+            case S_FIRST_DELAY:
+            case S_DISPENSE:
+                op.started = true;
+                break;
+
+            case S_ERROR:
+                op.finished_us = sim_now_us();
+                break;
+        }
+    }
+
+    sim_at(sim_now_us() + SIM_OPERATOR_TICK_US, operator_tick, NULL);
+}
+
+static bool sequence_over(void) {
+    return op.finished_us != 0 && sim_now_us() >= op.finished_us + SIM_DRAIN_US;
+}
+
+static void core0_main(void) {
+    firmware_main();
+}
+
+static bool load_state(const char *path) {
+    static sim_state_file_t file;
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL) {
+        return false;
+    }
+    bool ok = fread(&file, sizeof(file), 1, f) == 1 && file.magic == SIM_STATE_MAGIC;
+    fclose(f);
+
+    if (!ok) {
+        fprintf(stderr, "sim: %s isn't a state file, starting cold\n", path);
+        return false;
+    }
+    memcpy(eeprom_model_memory(), file.eeprom, EEPROM_SIZE);
+    carousel_set_state(&file.wheel);
+    uart_model_stats()->joined = file.modem_joined;
+    return true;
+}
+
+static void save_state(const char *path) {
+    static sim_state_file_t file;
+    FILE *f = fopen(path, "wb");
+
+    if (f == NULL) {
+        perror(path);
+        return;
+    }
+    file.magic = SIM_STATE_MAGIC;
+    file.wheel = carousel_get_state();
+    file.modem_joined = uart_model_stats()->joined;
+    memcpy(file.eeprom, eeprom_model_memory(), EEPROM_SIZE);
+    if (fwrite(&file, sizeof(file), 1, f) != 1) {
+        perror(path);
+    }
+    fclose(f);
+}
+
+static void report(uint64_t end_us, double host_s) {
+    const sim_stats_t *s = sim_get_stats();
+    sim_carousel_stats_t cs = carousel_get_stats();
+    sim_piezo_stats_t ps = piezo_model_get_stats();
+    sim_i2c_stats_t is = i2c_model_get_stats();
+    sim_uart_stats_t *us = uart_model_stats();
+
+    printf("\n--- simulation report ---\n");
+    printf("simulated time   %llu.%03llu s in %.3f s on the host\n",
+           (unsigned long long)(end_us / 1000000), (unsigned long long)(end_us / 1000 % 1000), host_s);
+    printf("firmware         %s, %d pills dispensed, %s\n", state_names[state], pills_dispensed,
+           calibrated ? "calibrated" : "not calibrated");
+    printf("carousel         %u pills loaded, %u dropped; %u steps, %u reversals, %u skipped, %u opto edges\n",
+           cs.pills_loaded, cs.pills_dropped, cs.steps, cs.reversals, cs.skipped, cs.opto_edges);
+    printf("piezo            %u hits, %u blocks sampled, %u dma overruns\n", ps.hits, ps.blocks, ps.overruns);
+
+    printf("blocked ms      ");
+    for (int b = 0; b < SIM_BLOCK_COUNT; b++) {
+        printf(" %10s", sim_block_name(b));
+    }
+    printf("\n");
+    for (int c = 0; c < SIM_CORES; c++) {
+        printf("  core %d        ", c);
+        for (int b = 0; b < SIM_BLOCK_COUNT; b++) {
+            printf(" %10.1f", s->blocked_us[c][b] / 1000.0);
+        }
+        printf("\n");
+    }
+
+    printf("irqs             core 0 %u, core 1 %u, %u held back by masking; %u timed events\n",
+           s->irqs[0], s->irqs[1], s->irqs_deferred, s->events);
+    printf("i2c              %u bytes in %u transfers, %u nacks, %u write cycles, %u bytes written\n",
+           is.bytes, is.transfers, is.nacks, is.write_cycles, is.bytes_written);
+    printf("uart1            %u bytes to the modem, %u back, %u rx overruns; %u commands, %u uplinks (%u payload bytes)\n",
+           us->tx_bytes, us->rx_bytes, us->rx_overruns, us->commands, us->uplinks, us->uplink_bytes);
+    printf("modem faults     %u busy, %u errors, %u lost, %u garbage lines, %u joins failed, %u uplinks without Done\n",
+           us->busy, us->errors, us->silent, us->garbage, us->join_failures, us->uplink_failures);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [--seconds N] [--seed N] [--missing K]... [--state FILE] [--modem FILE] [--piezo FILE] [--quiet] [--trace]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    double limit_s = SIM_DEFAULT_SECONDS;
+    uint32_t seed = 1;
+    const char *state_path = NULL;
+    const char *modem_script = NULL;
+    const char *piezo_path = NULL;
+    bool quiet = false;
+    bool trace = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--seconds") == 0 && has_value) {
+            limit_s = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--missing") == 0 && has_value) {
+            int k = atoi(argv[++i]);
+            if (k < 1 || k > MAX_PILLS) {
+                usage(argv[0]);
+            }
+            missing |= 1u << k;
+        } else if (strcmp(argv[i], "--state") == 0 && has_value) {
+            state_path = argv[++i];
+        } else if (strcmp(argv[i], "--modem") == 0 && has_value) {
+            modem_script = argv[++i];
+        } else if (strcmp(argv[i], "--piezo") == 0 && has_value) {
+            piezo_path = argv[++i];
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            quiet = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    sim_seed(seed);
+    if (modem_script != NULL && !modem_model_script(modem_script)) {
+        return 2;
+    }
+    FILE *piezo_file = NULL;
+    if (piezo_path != NULL) {
+        piezo_file = fopen(piezo_path, "w");
+        if (piezo_file == NULL) {
+            perror(piezo_path);
+            return 2;
+        }
+        piezo_model_record(piezo_file);
+    }
+
+    // cold boot: the carousel is wherever it was left, empty. warm boot: as saved
+    if (state_path == NULL || !load_state(state_path)) {
+        sim_carousel_state_t wheel = { .phase = -1 };
+        wheel.motor = wheel.output = sim_rand_range(0, SIM_STEPS_PER_REV - 1);
+        carousel_set_state(&wheel);
+    } else {
+        op.loaded = true;
+    }
+
+    int saved_stdout = -1;
+    if (quiet) {
+        fflush(stdout);
+        saved_stdout = dup(STDOUT_FILENO);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    sim_launch_core(0, core0_main);
+    sim_at(0, operator_tick, NULL);
+    uint64_t end_us = sim_run((uint64_t)(limit_s * 1e6), sequence_over);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (quiet) {
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+
+    if (piezo_file != NULL) {
+        piezo_model_record(NULL);
+        fclose(piezo_file);
+    }
+    if (trace) {
+        TRACE_DUMP();
+    }
+    if (state_path != NULL) {
+        save_state(state_path);
+    }
+    report(end_us, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    return 0;
+}
@@ -0,0 +1,218 @@
+// sim_time.c
+// pico/time.h on the virtual clock. alarms are timed events whose callbacks run as
+// TIMER_IRQ_0 handlers on core 0, like the SDK's default alarm pool
+
+#include <stdio.h>
+#include "pico/time.h"
+#include "sim.h"
+
+#define SIM_ALARMS 64   // the SDK pool has 16, a few spare so the model never runs out first
+
+typedef struct {
+    alarm_id_t id;          // 0 when the slot is free
+    int event;              // scheduler event while it's waiting to fire, 0 once it fired
+    uint64_t due_us;
+    alarm_callback_t callback;
+    void *user_data;
+} sim_alarm_t;
+
+static sim_alarm_t alarms[SIM_ALARMS];
+static alarm_id_t next_alarm_id = 1;
+
+uint64_t time_us_64(void) {
+    sim_clock_read();
+    return sim_now_us();
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+
+absolute_time_t get_absolute_time(void) {
+    return time_us_64();
+}
+
+uint32_t to_ms_since_boot(absolute_time_t t) {
+    return (uint32_t)(t / 1000);
+}
+
+uint64_t to_us_since_boot(absolute_time_t t) {
+    return t;
+}
+
+absolute_time_t from_us_since_boot(uint64_t us) {
+    return us;
+}
+
+absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) {
+    return t + us;
+}
+
+absolute_time_t delayed_by_ms(absolute_time_t t, uint32_t ms) {
+    return t + (uint64_t)ms * 1000;
+}
+
+absolute_time_t make_timeout_time_us(uint64_t us) {
+    return time_us_64() + us;
+}
+
+absolute_time_t make_timeout_time_ms(uint32_t ms) {
+    return time_us_64() + (uint64_t)ms * 1000;
+}
+
+int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) {
+    return (int64_t)(to - from);
+}
+
+bool time_reached(absolute_time_t t) {
+    return time_us_64() >= t;
+}
+
+void sleep_until(absolute_time_t t) {
+    sim_block(t, SIM_BLOCK_SLEEP);
+}
+
+void sleep_us(uint64_t us) {
+    sleep_until(sim_now_us() + us);
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_until(sim_now_us() + (uint64_t)ms * 1000);
+}
+
+void busy_wait_us(uint64_t us) {
+    sim_block(sim_now_us() + us, SIM_BLOCK_SPIN);
+}
+
+/**
+ true once t is reached, false if an irq or sev woke us first
+ */
+bool best_effort_wfe_or_timeout(absolute_time_t t) {
+    if (sim_now_us() >= t) {
+        return true;
+    }
+    sim_wait(t, true);
+    return sim_now_us() >= t;
+}
+
+static sim_alarm_t *find_alarm(alarm_id_t id) {
+    for (int i = 0; i < SIM_ALARMS; i++) {
+        if (id > 0 && alarms[i].id == id) {
+            return &alarms[i];
+        }
+    }
+    return NULL;
+}
+
+static void alarm_event(void *arg);
+
+/**
+ the timer irq for one alarm. the callback's return value reschedules it like the SDK:
+ < 0 from when it was due, > 0 from now, 0 not at all
+ */
+static void alarm_irq(void *arg) {
+    alarm_id_t id = (alarm_id_t)(intptr_t)arg;
+    sim_alarm_t *a = find_alarm(id);
+    if (a == NULL) {
+        return; // cancelled while the irq was held back
+    }
+    a->event = 0;
+
+    int64_t next = a->callback(id, a->user_data);
+
+    a = find_alarm(id);
+    if (a == NULL) {
+        return; // cancelled itself
+    }
+    if (next == 0) {
+        a->id = 0;
+        return;
+    }
+
+    a->due_us = next < 0 ? a->due_us + (uint64_t)(-next) : sim_now_us() + (uint64_t)next;
+    a->event = sim_at(a->due_us, alarm_event, arg);
+}
+
+static void alarm_event(void *arg) {
+    sim_irq_call(SIM_TIMER_IRQ, alarm_irq, arg);
+}
+
+alarm_id_t add_alarm_at(absolute_time_t t, alarm_callback_t callback, void *user_data, bool fire_if_past) {
+    if (t <= sim_now_us() && !fire_if_past) {
+        return 0;
+    }
+
+    for (int i = 0; i < SIM_ALARMS; i++) {
+        sim_alarm_t *a = &alarms[i];
+        if (a->id != 0) {
+            continue;
+        }
+
+        a->id = next_alarm_id;
+        next_alarm_id = next_alarm_id == INT32_MAX ? 1 : next_alarm_id + 1;
+        a->due_us = t;
+        a->callback = callback;
+        a->user_data = user_data;
+        a->event = sim_at(t, alarm_event, (void *)(intptr_t)a->id);
+        return a->id;
+    }
+
+    fprintf(stderr, "sim: out of alarms at %llu us\n", (unsigned long long)sim_now_us());
+    return -1;
+}
+
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void *user_data, bool fire_if_past) {
+    return add_alarm_at(sim_now_us() + us, callback, user_data, fire_if_past);
+}
+
+alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback, void *user_data, bool fire_if_past) {
+    return add_alarm_at(sim_now_us() + (uint64_t)ms * 1000, callback, user_data, fire_if_past);
+}
+
+bool cancel_alarm(alarm_id_t id) {
+    sim_alarm_t *a = find_alarm(id);
+    if (a == NULL) {
+        return false;
+    }
+    if (a->event != 0) {
+        sim_cancel(a->event);
+    }
+    a->id = 0;
+    return true;
+}
+
+static int64_t repeating_timer_alarm(alarm_id_t id, void *user_data) {
+    repeating_timer_t *rt = user_data;
+
+    if (!rt->callback(rt)) {
+        rt->alarm_id = 0;
+        return 0;
+    }
+    return rt->alarm_id == id ? rt->delay_us : 0;
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out) {
+    if (delay_us == 0) {
+        delay_us = 1;
+    }
+
+    out->delay_us = delay_us;
+    out->callback = callback;
+    out->user_data = user_data;
+    out->alarm_id = add_alarm_in_us((uint64_t)(delay_us < 0 ? -delay_us : delay_us), repeating_timer_alarm, out, true);
+    return out->alarm_id > 0;
+}
+
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out) {
+    return add_repeating_timer_us((int64_t)delay_ms * 1000, callback, user_data, out);
+}
+
+bool cancel_repeating_timer(repeating_timer_t *timer) {
+    bool cancelled = false;
+
+    if (timer->alarm_id > 0) {
+        cancelled = cancel_alarm(timer->alarm_id);
+    }
+    timer->alarm_id = 0;
+    return cancelled;
+}
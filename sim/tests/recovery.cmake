@@ -0,0 +1,24 @@
+# recovery.cmake
+# power cut regression: run blink_sim until CUT seconds with a state file, boot it warm
+# from that file and check the second run's output
+#
+# cmake -DSIM=path/to/blink_sim -DCUT=seconds -DSTATE=file -DEXPECT=regex [-DREJECT=regex] -P recovery.cmake
+
+file(REMOVE ${STATE})
+execute_process(COMMAND ${SIM} --seconds ${CUT} --state ${STATE}
+        OUTPUT_QUIET RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "first run failed: ${result}")
+endif()
+
+execute_process(COMMAND ${SIM} --state ${STATE} OUTPUT_VARIABLE output RESULT_VARIABLE result)
+file(REMOVE ${STATE})
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "warm boot failed: ${result}\n${output}")
+endif()
+if (NOT output MATCHES "${EXPECT}")
+    message(FATAL_ERROR "warm boot didn't print \"${EXPECT}\"\n${output}")
+endif()
+if (DEFINED REJECT AND output MATCHES "${REJECT}")
+    message(FATAL_ERROR "warm boot printed \"${REJECT}\"\n${output}")
+endif()
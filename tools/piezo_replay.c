@@ -0,0 +1,92 @@
+// piezo_replay.c
+// run a recorded piezo trace through the same detector the firmware uses (project/piezo_detect.h)
+// built with the host simulation (cmake without the Pico SDK), tools/traces/ are run by ctest
+// usage: piezo_replay [--expect N] trace.txt [sample_hz]   raw 12 bit ADC values, any separator, - for stdin
+//   --expect  exit 1 unless the trace has exactly N hits
+//
+// blink_sim --piezo FILE records traces from the simulated sensor
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "piezo_detect.h"
+
+#define BLOCK 256   // same block size as the firmware, state carries across blocks anyway
+
+int main(int argc, char **argv) {
+    int expect = -1;
+    int arg = 1;
+
+    if (argc > arg + 1 && strcmp(argv[arg], "--expect") == 0) {
+        expect = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if (argc <= arg || expect < -1) {
+        fprintf(stderr, "usage: %s [--expect N] trace.txt [sample_hz]\n", argv[0]);
+        return 2;
+    }
+
+    const char *path = argv[arg];
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (in == NULL) {
+        perror(path);
+        return 2;
+    }
+    long sample_hz = argc > arg + 1 ? strtol(argv[arg + 1], NULL, 10) : 10000;
+    if (sample_hz <= 0) {
+        sample_hz = 10000;
+    }
+
+    piezo_detect_config_t cfg = PIEZO_DETECT_DEFAULTS;
+    piezo_detector_t detector;
+    piezo_detect_init(&detector, &cfg);
+
+    uint16_t block[BLOCK];
+    size_t filled = 0;
+    int total_hits = 0;
+    int c;
+
+    // pull numbers out of whatever the logger wrote
+    while ((c = fgetc(in)) != EOF || filled > 0) {
+        if (c != EOF && (c < '0' || c > '9')) {
+            continue;
+        }
+
+        if (c != EOF) {
+            long value = c - '0';
+            while ((c = fgetc(in)) != EOF && c >= '0' && c <= '9') {
+                value = value * 10 + (c - '0');
+            }
+            block[filled++] = (uint16_t)(value > 0xFFFF ? 0xFFFF : value);
+        }
+
+        if (filled == BLOCK || (c == EOF && filled > 0)) {
+            piezo_hit_t hits[8];
+            int found = piezo_detect_process(&detector, block, filled, hits, 8);
+            filled = 0;
+
+            for (int i = 0; i < found; i++) {
+                printf("hit at sample %u (%.1f ms): %u samples long, peak %u, noise %u, confidence %u%%\n",
+                       hits[i].sample, hits[i].sample * 1000.0 / sample_hz, hits[i].length,
+                       hits[i].peak, hits[i].noise, hits[i].confidence);
+            }
+            total_hits += found;
+        }
+
+        if (c == EOF) {
+            break;
+        }
+    }
+
+    printf("%u samples (%.1f s), %d hits, final noise floor %u\n", detector.samples,
+           (double)detector.samples / sample_hz, total_hits, piezo_detect_noise(&detector));
+
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (expect >= 0 && total_hits != expect) {
+        printf("expected %d hits\n", expect);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+// uplink_decode.c
+// host side decoder for the binary uplink frames (see project/uplink.h)
+// built with the host simulation (cmake without the Pico SDK)
+// usage: uplink_decode 1170000005 ...   or one hex frame per line on stdin
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "uplink.h"
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = (char)tolower((unsigned char)c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static void decode_frame(const char *hex) {
+    uint8_t frame[UPLINK_MAX_PAYLOAD];
+    size_t len = 0;
+
+    while (*hex && !isspace((unsigned char)*hex)) {
+        int hi = hex_value(hex[0]);
+        int lo = hex[1] ? hex_value(hex[1]) : -1;
+        if (hi < 0 || lo < 0 || len >= sizeof(frame)) {
+            printf("bad hex frame\n");
+            return;
+        }
+        frame[len++] = (uint8_t)((hi << 4) | lo);
+        hex += 2;
+    }
+
+    uplink_event_t events[UPLINK_MAX_EVENTS];
+    int count = uplink_decode(frame, len, events, UPLINK_MAX_EVENTS);
+    if (count < 0) {
+        printf("malformed frame (%zu bytes)\n", len);
+        return;
+    }
+
+    printf("frame: %d events\n", count);
+    for (int i = 0; i < count; i++) {
+        printf("  -%6.1f s  %-20s", events[i].timestamp_ms / 1000.0, uplink_event_name(events[i].code));
+        if (events[i].pill != UPLINK_NO_PILL) printf(" pill %d", events[i].pill + 1);
+        printf("%s%s%s\n",
+               events[i].flags & UPLINK_FLAG_CALIBRATED ? " [calibrated]" : "",
+               events[i].flags & UPLINK_FLAG_DISPENSING ? " [moving]" : "",
+               events[i].flags & UPLINK_FLAG_EEPROM_OK ? "" : " [no eeprom]");
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) decode_frame(argv[i]);
+        return 0;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), stdin)) {
+        char *p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p) decode_frame(p);
+    }
+    return 0;
+}